@@ -0,0 +1,59 @@
+/**
+ * Author: Glenn Skelton
+ *
+ * Closed uniform cubic B-spline defined by the control points of a track file.
+ * This is the limit curve of cubicSubdivideCurve(), evaluated in closed form so
+ * the track can be sampled at any parameter without materializing subdivisions.
+ */
+
+
+#pragma once
+
+#include <vector>
+
+#include "curve.h"
+#include "vec3f.h"
+
+namespace math {
+namespace geometry {
+
+class BSplineCurve {
+public:
+    BSplineCurve();
+    BSplineCurve(Points controlPoints);
+    BSplineCurve(Curve const &controlPolygon);
+
+    // parameter t runs over [0, segmentCount()) and wraps around, t = 0 is the
+    // same point as index 0 of cubicSubdivideCurve() on the same control points
+    Vec3f position(double t) const;
+    Vec3f firstDerivative(double t) const;
+    Vec3f secondDerivative(double t) const;
+
+    size_t segmentCount() const;
+    Points const &controlPoints() const;
+
+private:
+    size_t segmentOf(double t, double &u) const;
+
+    Points m_controlPoints;
+};
+
+// Polyline through the spline with the spline parameter of every point
+struct ParameterizedCurve {
+    Curve curve;
+    std::vector<double> parameters;
+};
+
+// Free functions
+double arcLength(BSplineCurve const &spline, double t0, double t1);
+double length(BSplineCurve const &spline);
+
+// refine each segment only until the chord error and the turning angle across
+// every piece are within tolerance (angle in degrees)
+ParameterizedCurve adaptiveSubdivideCurve(BSplineCurve const &spline,
+                                          float chordTolerance,
+                                          float angleTolerance,
+                                          int maxDepth = 16);
+
+} // namespace geometry
+} // namespace math
@@ -11,6 +11,7 @@
 #include <iosfwd>
 #include <vector>
 
+#include "curvesoa.h"
 #include "vec3f.h"
 
 namespace math {
@@ -24,8 +25,7 @@ public:
     Curve(Points points);
     Curve(Points points, bool isClosedCurve);
 
-    Vec3f operator[](int idx) const;
-    Vec3f &operator[](int idx);
+    Vec3f operator[](int idx) const; // read only, points change through setPoint()
     Vec3f front() const;
     Vec3f back() const;
 
@@ -36,21 +36,36 @@ public:
     size_t pointCount() const;
     Vec3f const *data() const;
     Points const &points() const;
+    CurveSoA const &soa() const; // the same points as separate x, y and z arrays
 
     bool isClosed() const;
     void setClosed(bool);
 
+    // Arc length queries, backed by a prefix-sum table that every change to
+    // the points rebuilds along with the SoA copy, so const access never
+    // writes and is thread safe.
+    double length() const;
+    double arcLength(size_t idx) const;
+    std::vector<double> const &arcLengths() const;
+    size_t segmentAtArcLength(double s) const;
+
 private:
+    void rebuildArcLengths();
+
     Points m_points;
     bool m_isClosedCurve = false;
+    CurveSoA m_soa;
+
+    std::vector<double> m_arcLengths; // distance from the first point to each point
+    double m_length = 0.0;            // includes the wrap around segment if closed
 };
 
 // Free functions
 float length(Curve const &curve);
 
-Curve cubicSubdivideCurve(Curve curve, int numberOfSubdivisionSteps);
+Curve cubicSubdivideCurve(Curve const &curve, int numberOfSubdivisionSteps);
 Curve repeatedAveraging(Curve const &curve, int numberOfAveragingSteps);
-Points repeatedAveraging(Points points, int numberOfAveragingSteps);
+Points repeatedAveraging(Points const &points, int numberOfAveragingSteps);
 
 } // namespace geometry
 } // namespace math
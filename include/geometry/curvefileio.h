@@ -9,7 +9,9 @@
 
 #pragma once
 
+#include <cstdint>
 #include <string>
+#include <vector>
 
 #include "curve.h"
 
@@ -22,5 +24,20 @@ math::geometry::Curve loadCurveFromFile(std::string const &filePath);
 
 math::geometry::Curve loadCurveFrom_OBJ_File(std::string const &filePath);
 
+// Binary cache of a processed curve. The key should identify everything the
+// curve was computed from (source file contents and processing parameters), a
+// cache with a different key or format version is treated as a miss.
+uint64_t hashFileContents(std::string const &filePath, uint64_t seed = 14695981039346656037ull);
+uint64_t hashCombine(uint64_t seed, uint64_t value);
+
+bool saveCurveToCache(math::geometry::Curve const &curve,
+                      std::vector<double> const &parameters,
+                      uint64_t key,
+                      std::string const &filePath);
+bool loadCurveFromCache(std::string const &filePath,
+                        uint64_t key,
+                        math::geometry::Curve &curve,
+                        std::vector<double> &parameters);
+
 } // namespace geometry
 } // namespace math
@@ -0,0 +1,76 @@
+/**
+ * Author: Glenn Skelton
+ *
+ * Structure of arrays copy of the points of a Curve. The x, y and z coordinates
+ * live in separate aligned arrays so the segment length and height scans run
+ * with SSE2/AVX2 vector instructions. Curve keeps one next to its AoS points,
+ * which stay the storage for operator[], data() and the GL upload.
+ */
+
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <vector>
+
+#include "vec3f.h"
+
+namespace math {
+namespace geometry {
+
+// Allocator that hands out 32 byte aligned storage (one AVX register)
+template <typename T>
+struct AlignedAllocator {
+    using value_type = T;
+    static constexpr std::size_t ALIGNMENT = 32;
+
+    AlignedAllocator() = default;
+    template <typename U>
+    AlignedAllocator(AlignedAllocator<U> const &) {}
+
+    T *allocate(std::size_t n) {
+        std::size_t bytes = ((n * sizeof(T) + ALIGNMENT - 1) / ALIGNMENT) * ALIGNMENT;
+        return static_cast<T *>(::operator new(bytes, std::align_val_t(ALIGNMENT)));
+    }
+    void deallocate(T *p, std::size_t) { ::operator delete(p, std::align_val_t(ALIGNMENT)); }
+
+    template <typename U>
+    bool operator==(AlignedAllocator<U> const &) const { return true; }
+    template <typename U>
+    bool operator!=(AlignedAllocator<U> const &) const { return false; }
+};
+
+using AlignedFloats = std::vector<float, AlignedAllocator<float>>;
+
+class CurveSoA {
+public:
+    CurveSoA();
+    explicit CurveSoA(std::vector<Vec3f> const &points);
+
+    size_t pointCount() const;
+    float const *x() const;
+    float const *y() const;
+    float const *z() const;
+
+private:
+    AlignedFloats m_x, m_y, m_z;
+};
+
+struct HeightExtrema {
+    uint32_t minIndex = 0;
+    uint32_t maxIndex = 0;
+    float minHeight = 0.f;
+    float maxHeight = 0.f;
+};
+
+// Free functions (vectorized)
+
+// lengths[i] = distance(p[i], p[i + 1]) for the pointCount() - 1 open segments,
+// bit-identical to distance() on the AoS points
+void segmentLengths(CurveSoA const &curve, float *lengths);
+HeightExtrema heightExtrema(CurveSoA const &curve); // lowest index wins ties
+
+} // namespace geometry
+} // namespace math
@@ -9,8 +9,16 @@
 #ifndef COASTERPHYSICS_H
 #define COASTERPHYSICS_H
 
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
 #include "curve.h"
+#include "bsplinecurve.h"
 #include "Geometry.h"
+#include "TrackStats.h"
 
 
 using namespace std;
@@ -18,25 +26,117 @@ using namespace std;
 namespace math {
 namespace physics {
 
-enum PHASE {LIFT = 0, FALL = 1, END = 2};
+enum PHASE {LIFT = 0, FALL = 1, END = 2, STATION = 3};
 
 /************************ CONSTANTS ****************************/
 
-// TRACK DEFENITIONS
-const unsigned int LIFT_START = 168000;
-const unsigned DECEL_START = 140000;
+// TRACK DEFENITIONS (arc lengths, the phases themselves come from the track's .phases file)
+const double BRAKE_OVERRUN = 0.5; // brakes slow down towards this far past their end
+const double TOP_OVERRUN = 0.15; // default layout, the lift carries on this far past the highest point
+
+// bump whenever ttlArcLengthReParam produces different output so cached tracks are rebuilt
+const unsigned int REPARAM_VERSION = 2;
 
 // lift speed of incline
 const double LIFT_SPEED = 1.0f;
 
 const double GRAVITY = 9.81f; // m/s^2
 
+// speed trains roll through a station at
+const double STATION_SPEED = 0.5;
+
+
+/************************** TYPES ***************************/
+
+// tunable ride physics, the defaults are the ride as designed
+struct PhysicsParameters {
+    double liftSpeed = LIFT_SPEED;
+    double gravity = GRAVITY;
+    double stationSpeed = STATION_SPEED;
+};
+
+// one section of the track, it runs from start (an arc length) up to the start
+// of the next section
+struct PhaseRange {
+    PHASE phase = FALL;
+    double start = 0.0;
+};
+
+using PhaseLayout = std::vector<PhaseRange>; // sorted by start, covers the whole loop
+
+// stretch of track between two arc lengths
+struct ArcRange {
+    double start = 0.0;
+    double end = 0.0;
+};
+
+// stretch of track between two curve points, both included
+struct PointRange {
+    unsigned int first = 0;
+    unsigned int last = 0;
+};
+
+// track data shared by every train, computed once when the curve is loaded
+struct SimulationContext {
+    SimulationContext();
+    SimulationContext(const math::geometry::Curve &curve,
+                      const PhaseLayout &phases,
+                      const PhysicsParameters &parameters = PhysicsParameters());
+
+    void setPhases(const PhaseLayout &layout); // empty gives the default layout
+
+    const math::geometry::Curve *curve = nullptr; // must outlive the context
+    PhysicsParameters parameters;
+    PhaseLayout phases;
+    vector<uint8_t> rangeOf; // index into phases of every curve point
+    std::shared_ptr<const TrackStats> stats; // height range queries, shared by copies of the context
+    double length = 0.0; // arc length of the closed track
+    double deltaS = 0.0; // distance between curve points
+    int maxIndex = -1;
+    double maxHeight = 0.0;
+    int minIndex = -1;
+    double minHeight = 0.0;
+};
+
+// everything that changes as one train moves around the track
+struct TrainState {
+    TrainState();
+    explicit TrainState(const SimulationContext &context); // at the start of the lift
+    TrainState(const SimulationContext &context, unsigned int start);
+
+    unsigned int index = 0; // curve point at or just behind the middle car
+    double s = 0.0; // arc length along the track to the middle car
+    double velocity = 0.0; // speed of the last step
+    double fallVelocity = 0.0; // speed at the end of the fall, the brakes slow down from it
+    PHASE phase = LIFT;
+};
+
+// orientation of the track at one curve point, rotation is the row major 3x3
+// basis [binormal normal tangent] expanded by getOrientation()
+struct TrackFrame {
+    math::Vec3f tangent;
+    math::Vec3f normal;
+    math::Vec3f binormal;
+    std::array<float, 9> rotation;
+};
+
+using TrackFrames = std::vector<TrackFrame>; // one frame per curve point
+
+// processed track, sampled evenly by arc length from the spline
+struct Track {
+    math::geometry::Curve curve;
+    math::geometry::BSplineCurve spline; // limit curve of the control points
+    vector<double> parameters; // spline parameter of each curve point
+    PhaseLayout phases;
+    vector<PointRange> loops; // built without supports so the train can pass through
+};
+
 
 /************************** FUNCTIONS ***************************/
 
 //double getVelocity(double deltaTime, double deltaDistance);
 double getVelocity(math::Vec3f pos);
-double getFreefallVelocity(double maxHeight, double curHeight);
+double getFreefallVelocity(double maxHeight, double curHeight, double gravity = GRAVITY);
 double getDecelerationVelocity(const math::Vec3f &startPos,
                                const math::Vec3f &curPos,
                                const math::Vec3f &endPos,
@@ -44,38 +144,82 @@ double getDecelerationVelocity(const math::Vec3f &startPos,
 double getDistance(double velocity, double deltaTime);
 
 // FRAMING THE CURVE
-double v(const math::geometry::Curve &curve, unsigned int index);
-unsigned int getPosition(const math::geometry::Curve &curve,
+PHASE getPhase(const SimulationContext &context, unsigned int index);
+math::Vec3f getBrakeStart(const SimulationContext &context, unsigned int range);
+math::Vec3f getBrakeEnd(const SimulationContext &context, unsigned int range);
+double distanceIntoPhase(const SimulationContext &context, double s);
+double v(const SimulationContext &context, TrainState &state, unsigned int index);
+unsigned int getPosition(const SimulationContext &context,
                          unsigned int cur,
                          double dv,
                          double dt);
-math::Vec3f getVelocity(const math::geometry::Curve &curve,
+math::Vec3f getVelocity(const SimulationContext &context,
+                        TrainState state,
                         unsigned int cur,
                         double dt);
-math::Vec3f getAcceleration(const math::geometry::Curve &curve,
+math::Vec3f getAcceleration(const SimulationContext &context,
+                            TrainState state,
                             unsigned int cur,
                             double dt);
+void stepTrain(const SimulationContext &context, TrainState &state, double dt);
+
+// CONTINUOUS POSITION
+double wrapArcLength(const SimulationContext &context, double s);
+double interpolateArcLength(const SimulationContext &context, double s0, double s1, double alpha);
+unsigned int getIndex(const SimulationContext &context, double s);
+math::Vec3f getPointAt(const SimulationContext &context, double s);
+TrackFrame getFrameAt(const SimulationContext &context, const TrackFrames &frames, double s);
+
+
+
+// TRACK LOADING
+bool loadTrack(const string &filePath,
+               const string &cachePath,
+               unsigned int samplesPerUnit,
+               Track &track);
+string getPhaseFilePath(const string &trackFilePath);
+bool loadPhaseLayout(const string &filePath, double length, PhaseLayout &phases, vector<ArcRange> *loops = nullptr);
+PointRange getPointRange(const math::geometry::Curve &curve, const ArcRange &range);
+PhaseLayout defaultPhaseLayout(const math::geometry::Curve &curve);
 
+// TRACK PHASES
+const char *getPhaseName(PHASE phase);
+bool hasPhase(const PhaseLayout &phases, PHASE phase);
+double getPhaseStart(const PhaseLayout &phases, PHASE phase);
+bool setPhaseStart(PhaseLayout &phases, PHASE phase, double start, double length);
 
 
 // ARC LENGTH REPARAM
-math::geometry::Curve ttlArcLengthReParam(const math::geometry::Curve &curve, int numDivisions);
+math::geometry::Curve ttlArcLengthReParam(const math::geometry::BSplineCurve &spline,
+                                          int numDivisions,
+                                          vector<double> *parameters = nullptr);
 
 
 // TRACK ORIENTATIONS
 void generateTrack(const math::geometry::Curve &curve,
-                                  opengl::Geometry &track,
-                                  double deltaTime);
+                   const TrackFrames &frames,
+                   opengl::Geometry &track);
 void generateSupports(const math::geometry::Curve &curve,
-                                     opengl::Geometry &supports,
-                                     double deltaTime);
-math::Mat4f getOrientation(const math::geometry::Curve &curve, unsigned int pos, double deltaTime);
+                      const TrackFrames &frames,
+                      const vector<PointRange> &loops,
+                      opengl::Geometry &supports);
+math::Mat4f getOrientation(const SimulationContext &context, const TrainState &state, unsigned int pos, double deltaTime);
+math::Mat4f getOrientation(const TrackFrames &frames, unsigned int pos);
+math::Mat4f getOrientation(const TrackFrame &frame);
+TrackFrames computeTrackFrames(const math::geometry::Curve &curve, const PhaseLayout &phases, double deltaTime);
+TrackFrames computeRotationMinimizingFrames(const math::geometry::Curve &curve,
+                                            const vector<float> *twist = nullptr);
+vector<float> getBankAngles(const TrackFrames &frames, const TrackFrames &target, unsigned int window);
+TrackFrames computeBankedFrames(const math::geometry::Curve &curve,
+                                const PhaseLayout &phases,
+                                double deltaTime,
+                                unsigned int smoothing);
 
 
 // ORIENTATION
-math::Vec3f getNormal(const math::geometry::Curve &curve, unsigned int pos, double deltaTime);
-math::Vec3f getTangent(const math::geometry::Curve &curve, unsigned int pos, double deltaTime);
-math::Vec3f getBinormal(const math::geometry::Curve &curve, unsigned int pos, double deltaTime);
+math::Vec3f getNormal(const SimulationContext &context, const TrainState &state, unsigned int pos, double deltaTime);
+math::Vec3f getTangent(const SimulationContext &context, const TrainState &state, unsigned int pos, double deltaTime);
+math::Vec3f getBinormal(const SimulationContext &context, const TrainState &state, unsigned int pos, double deltaTime);
 
 
 double getMaxHeight(const math::geometry::Curve &curve);
@@ -0,0 +1,40 @@
+/**
+ * Author: Glenn Skelton
+ *
+ * Converts wall clock time into a whole number of fixed length simulation steps
+ * so the physics runs at the same speed no matter how fast frames are drawn.
+ * The time left over after the last step is kept for the next frame and is
+ * exposed as a fraction of a step for interpolating the drawn state.
+ */
+
+
+#ifndef FIXEDTIMESTEP_H
+#define FIXEDTIMESTEP_H
+
+#include <chrono>
+
+namespace opengl {
+
+class FixedTimestep {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    FixedTimestep();
+    explicit FixedTimestep(double stepSeconds, unsigned int maxStepsPerFrame = 8);
+
+    void reset(); // drop any pending time and start measuring from now
+    unsigned int advance(); // number of steps due since the last call
+
+    double alpha() const; // fraction of a step waiting in the accumulator [0, 1)
+    double stepSeconds() const;
+
+private:
+    double m_stepSeconds;
+    unsigned int m_maxStepsPerFrame; // caps the catch up after a long stall
+    double m_accumulator = 0.0;
+    Clock::time_point m_last;
+};
+
+} // namespace opengl
+
+#endif // FIXEDTIMESTEP_H
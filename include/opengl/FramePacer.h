@@ -0,0 +1,60 @@
+/**
+ * Author: Glenn Skelton
+ *
+ * Paces the main loop to a target frame rate by sleeping until the deadline of
+ * the next frame instead of spinning on the clock, and keeps running statistics
+ * of the time between frames. A rate of zero runs uncapped for benchmarking.
+ */
+
+
+#ifndef FRAMEPACER_H
+#define FRAMEPACER_H
+
+#include <chrono>
+#include <iostream>
+
+namespace opengl {
+
+class FramePacer {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // frame times in milliseconds
+    struct Statistics {
+        unsigned long frames = 0;
+        double mean = 0.0;
+        double min = 0.0;
+        double max = 0.0;
+        double standardDeviation = 0.0;
+    };
+
+    FramePacer();
+    explicit FramePacer(double framesPerSecond); // zero or less is uncapped
+
+    void setRate(double framesPerSecond);
+    bool isUncapped() const;
+
+    double secondsUntilNextFrame() const; // zero when a frame is due
+    void waitForNextFrame(); // sleep until the next frame is due
+    void frameFinished(); // record the frame time and schedule the next frame
+    void restart(); // start timing again without recording, e.g. after waiting for input
+
+    Statistics statistics() const;
+    void resetStatistics();
+
+private:
+    Clock::duration m_interval;
+    Clock::time_point m_nextFrame;
+    Clock::time_point m_lastFrame;
+
+    // running mean and variance of the frame time (Welford)
+    unsigned long m_frames = 0;
+    double m_mean = 0.0, m_m2 = 0.0;
+    double m_min = 0.0, m_max = 0.0;
+};
+
+std::ostream &operator<<(std::ostream &out, FramePacer::Statistics const &stats);
+
+} // namespace opengl
+
+#endif // FRAMEPACER_H
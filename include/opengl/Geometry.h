@@ -14,6 +14,7 @@
 #include "glad/glad.h"
 #include <GLFW/glfw3.h>
 
+#include <cstddef>
 #include <iostream>
 #include <vector>
 
@@ -24,6 +25,15 @@ using namespace std;
 
 namespace opengl {
 
+// One vertex as it is laid out in the vertex buffer, the attributes a vertex
+// shader reads sit next to each other so each vertex is fetched in one go
+struct Vertex {
+    math::Vec3f position; // layout 0
+    math::Vec3f normal; // layout 1
+    math::Vec3f colour; // layout 2
+};
+static_assert(sizeof(Vertex) == 9 * sizeof(float), "vertex attributes must be tightly packed");
+
 // Data needed rendering for mesh and line
 class Geometry {
 public:
@@ -32,18 +42,12 @@ public:
 
     vector<Geometry*> children; // scene graph
 
-    // data structure for verts, normals, uv's, and colours
-    vector<math::Vec3f> verts;
-    vector<math::Vec3f> normals;
-    vector<math::Vec3f> colours;
-    vector<math::Vec3f> uvs;
+    // interleaved vertices, uploaded to a single vertex buffer
+    vector<Vertex> vertices;
 
     // Buffer ID's
     GLuint vaoID = 0;
     GLuint vertexBufferID = 0;
-    GLuint normalBufferID = 0;
-    GLuint uvBufferID = 0;
-    GLuint colourBufferID = 0;
     GLuint indexBufferID = 0;
 
     GLuint verticesCount = 0;
@@ -9,23 +9,34 @@
 #ifndef GRAPHICSPROGRAM_H
 #define GRAPHICSPROGRAM_H
 
+#include <atomic>
 #include <cmath>
+#include <condition_variable>
+#include <functional>
 #include <iostream>
 #include <limits>
+#include <mutex>
+#include <thread>
 #include <vector>
 #include <irrKlang.h>
 
+#include "bsplinecurve.h"
 #include "camera.h"
 #include "curve.h"
 #include "curvefileio.h"
 #include "mat4f.h"
 #include "openglmatrix.h"
 #include "program.h"
+#include "spscqueue.h"
+#include "taskgraph.h"
+#include "triplebuffer.h"
 #include "vec3f.h"
 
 #include "Geometry.h"
 #include "RenderingEngine.h"
 #include "CoasterPhysics.h"
+#include "FixedTimestep.h"
+#include "FramePacer.h"
 
 using namespace opengl;
 using namespace std;
@@ -35,6 +46,28 @@ class GLFWwindow;
 
 enum ANGLE {CAR = 0, DISTANT = 1, TRACKING = 2};
 
+// input from the GLFW callbacks for the simulation thread to apply
+struct SimulationCommand {
+    enum Type {TOGGLE_PLAY, PLAY, STEP, CAMERA_MOVE, CAMERA_ANGLE, CAMERA_ORBIT, PANNING_SPEED, ROTATION_SPEED};
+
+    Type type = PLAY;
+    int value = 0; // CameraUpdate flag for CAMERA_MOVE, ANGLE for CAMERA_ANGLE
+    bool set = false; // whether the CAMERA_MOVE key is held
+    float x = 0.f, y = 0.f; // orbit angles, or the speed factor in x
+};
+
+// state the simulation thread publishes to the render thread after every tick
+struct SimulationSnapshot {
+    double previousS = 0.0; // arc length of the train before the last step
+    double s = 0.0; // arc length of the train after the last step
+    double stepTime = 0.0; // steady clock seconds when the last step was due
+    double stepSeconds = 0.0;
+    bool play = false;
+    bool cameraMoving = false; // a camera movement key is held
+    ANGLE angle = DISTANT;
+    openGL::scene::Camera camera; // the user controlled camera used by DISTANT
+};
+
 class GraphicsProgram {
 public:
 
@@ -50,21 +83,35 @@ public:
     void resizeFunc();
 
     bool init();
+    bool loadScene();
+    bool uploadFinishedAssets();
+    void drawLoadingScreen();
+    bool loadSounds();
 
     void setupScene(vector<Geometry*> graph);
     void deleteScene(vector<Geometry*> graph);
     bool loadInTrack();
+    bool loadTrackFrames();
+    bool loadSimulation();
     void loadInGeometry();
-    bool loadMeshGeometryToGPU();
+    bool loadMeshGeometryToGPU(Geometry &geometry);
     bool loadCurveGeometryToGPU();
 
     void reloadProjectionMatrix();
     void reloadViewMatrix();
 
-    void animate(int t);
-    void oncePerFrame();
-    void updateTrain(unsigned int vertexID);
+    void animate(double s);
+    void updateTrain(double s);
+
+    // simulation thread
+    void simulationLoop();
+    void applyCommand(const SimulationCommand &command);
     void simulationStep(int t);
+    void updateAudio();
+    void moveUserCamera(int t);
+    void publishState();
+    void sendCommand(const SimulationCommand &command); // called by the callbacks
+    void wakeSimulation(); // after a command or on shutdown
 
     void moveCamera();
     void resetCamera(openGL::scene::Camera &camera);
@@ -75,10 +122,10 @@ public:
     RenderingEngine *renderer; // rendering engine reference
 
     // AUDIO PLAYER AND ATTR
-    ISoundEngine *mediaPlayer;
-    ISoundSource *liftSFX;
-    ISoundSource *roarSFX;
-    ISound *liftAudio, *roarAudio;
+    ISoundEngine *mediaPlayer = nullptr;
+    ISoundSource *liftSFX = nullptr;
+    ISoundSource *roarSFX = nullptr;
+    ISound *liftAudio = nullptr, *roarAudio = nullptr;
     bool liftAudioPlaying = false, roarAudioPlaying = false;
 
 
@@ -90,7 +137,7 @@ public:
     Geometry g_car1Data, g_car2Data, g_car3Data;
 
 ///////////////////////////////////////////////////////
-    const unsigned int carDistance = 350; // indices
+    const double carDistance = 0.35; // arc length between the cars
 //////// CHANGE ///////////////////////////////////////
 
     Geometry g_floorData, g_gateData, g_trackData, g_supportsData;
@@ -99,24 +146,59 @@ public:
     math::Vec3f supportsColour = math::Vec3f(1, 0, 0);
     math::Vec3f groundColour = math::Vec3f(0.177, 0.341, 0.173);
     math::Vec3f gateColour = math::Vec3f(0.71, 0.396, 0.114); // light brown
-    vector<Geometry*> sceneGraph; // to store all of the geometry for iterating through
+    vector<Geometry*> sceneGraph; // to store all of the geometry for iterating through, once uploaded
+
+
+    // LOADING, the startup tasks run on a loader thread while the main thread
+    // draws and does the GPU work of each task once it has finished
+    util::TaskGraph g_startup;
+    vector<pair<util::TaskGraph::TaskId, function<bool()>>> g_uploads; // waiting for their task
+    ShaderSources g_shaderSources;
 
 
     // BACKGROUND COLOUR
     math::Vec3f BACKGROUND = math::Vec3f(0.529, 0.808, 0.922);
 
 
+    // THREADS, the simulation thread owns the train, the audio, the user camera and
+    // the play state, the render thread only sees them through published snapshots
+    std::thread g_simulationThread;
+    std::atomic<bool> g_simulating{false};
+    util::TripleBuffer<SimulationSnapshot> g_snapshots; // simulation -> render
+    util::SpscQueue<SimulationCommand, 256> g_commands; // callbacks -> simulation
+    std::mutex g_commandMutex; // only guards the simulation thread sleeping while idle
+    std::condition_variable g_commandReady; // signalled for every command and on shutdown
+
+
     // TRAIN PARAMETERS
     const double TIME = 0.015f; // delta t steps in seconds (I made my steps larger)
-    uint32_t curveVertexID = 0; // global index storage (arbitrary start point)
+    math::physics::SimulationContext g_simulation; // track data shared by the physics
+    math::physics::TrainState g_train; // position and speed of the train
+    math::physics::TrainState g_previousTrain; // state before the last step, blended with g_train for drawing
+    double g_displayS = 0.0; // interpolated arc length the train is drawn at (render thread)
+
+
+    // TIMING
+    double g_simulationRate = 1.0 / TIME; // physics steps per second of wall time
+    double g_renderRate = 60.0; // frames drawn per second, 0 draws as fast as possible
+    FixedTimestep g_timestep; // turns wall time into physics steps
+    FramePacer g_pacer; // sleeps between frames and records frame times
+    bool g_benchmark = false; // draw uncapped without vsync to measure frame times
+    double g_idleTimeout = 0.5; // longest wait for input while nothing is moving (seconds)
 
 
     // CURVE GEOMETRY
     Geometry g_curveData;
     string g_curveFilePath = "./curves/rollerCoaster.obj";
+    string g_curveCachePath = "./curves/rollerCoaster.cache"; // processed track from the last run
+    const unsigned int g_samplesPerUnit = 1000; // arc length samples per unit of track
     math::geometry::Curve g_curve; // data structure for storing curve points
-
-    const int32_t g_numberOfSubdivisions = 19; // number of subdivisions for defining curve smoothness
+    math::geometry::BSplineCurve g_spline; // smooth track through the control points
+    vector<double> g_curveParameters; // spline parameter of each curve point
+    math::physics::PhaseLayout g_trackPhases; // sections of the track from its .phases file
+    vector<math::physics::PointRange> g_trackLoops; // curve points inside the loops, kept clear of supports
+    math::physics::TrackFrames g_trackFrames; // orientation at each curve point
+    const unsigned int g_bankSmoothing = 250; // points either side averaged into the banking
 
 
     // LIGHTING
@@ -132,14 +214,16 @@ public:
     // CAMERA AND ATTRIBUTES
     math::Vec3f CAM_POS = math::Vec3f(12.0, 12.0, 12.0);
     openGL::scene::Camera CAM_DEFAULT;
-    openGL::scene::Camera g_camera; // scene camera
+    openGL::scene::Camera g_camera; // camera the scene is drawn from (render thread)
+    openGL::scene::Camera g_userCamera; // camera moved by the user (simulation thread)
     openGL::scene::CameraUpdate g_cameraUpdate; // camaera update struct
     ANGLE CAMERA_ANGLE = DISTANT;
 
 
     // CAMERA PROPERTIES
-    float g_rotationSpeed = 1.0f;
-    float g_panningSpeed = 0.25f;
+    float g_rotationSpeed = 1.0f; // degrees per frame at g_cameraFrameRate
+    float g_panningSpeed = 0.25f; // distance per frame at g_cameraFrameRate
+    const double g_cameraFrameRate = 60.0;
     float g_cursorSpeed = 0.05f;
     bool g_cursorLocked;
     float g_cursorX, g_cursorY;
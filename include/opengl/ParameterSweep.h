@@ -0,0 +1,82 @@
+/**
+ * Author: Glenn Skelton
+ *
+ * Simulates one lap of the ride for every combination of a set of physics
+ * parameter ranges and collects the lap time, top speed and g forces of each
+ * run. Every run shares the same read only curve and frames, only the small
+ * simulation context is copied per run, so the runs can go across all cores.
+ */
+
+
+#ifndef PARAMETERSWEEP_H
+#define PARAMETERSWEEP_H
+
+#include <string>
+#include <vector>
+
+#include "CoasterPhysics.h"
+
+namespace util {
+class ThreadPool;
+}
+
+namespace math {
+namespace physics {
+
+// inclusive range sampled at count evenly spaced values, no values keeps what the track has
+struct SweepRange {
+    SweepRange();
+    SweepRange(double value); // a single value
+    SweepRange(double first, double last, unsigned int count);
+
+    double value(unsigned int i) const;
+
+    double first = 0.0;
+    double last = 0.0;
+    unsigned int count = 0;
+};
+
+struct SweepRanges {
+    SweepRange liftSpeed = SweepRange(LIFT_SPEED);
+    SweepRange gravity = SweepRange(GRAVITY);
+    SweepRange liftStart; // arc length the lift (and the end of the brakes) moves to
+    SweepRange decelStart; // arc length the brakes move to
+};
+
+// one ride to simulate
+struct SweepRun {
+    PhysicsParameters parameters;
+    PhaseLayout phases;
+};
+
+// g forces are in units of standard gravity, the normal force is positive into the seat
+struct RideMetrics {
+    PhysicsParameters parameters;
+    PhaseLayout phases;
+    bool completed = false; // the train made it back to the lift
+    double lapTime = 0.0; // seconds from the start of the lift back to it
+    double peakSpeed = 0.0;
+    double maxNormalG = 0.0;
+    double minNormalG = 0.0; // negative when riders are lifted out of their seats
+    double maxLateralG = 0.0; // largest sideways force in either direction
+};
+
+// every combination of the ranges that gives a valid ride on this track
+std::vector<SweepRun> sweepCombinations(const SweepRanges &ranges,
+                                        const SimulationContext &track,
+                                        unsigned int *skipped = nullptr);
+RideMetrics simulateLap(const SimulationContext &context,
+                        const TrackFrames &frames,
+                        double dt,
+                        unsigned long maxSteps);
+std::vector<RideMetrics> runSweep(const SimulationContext &track,
+                                  const TrackFrames &frames,
+                                  const std::vector<SweepRun> &runs,
+                                  double dt,
+                                  util::ThreadPool &pool);
+bool writeSweepResults(const std::string &filePath, const std::vector<RideMetrics> &results);
+
+} // namespace physics
+} // namespace math
+
+#endif // PARAMETERSWEEP_H
@@ -13,6 +13,7 @@
 
 #include <vector>
 #include <iostream>
+#include <string>
 
 #include "program.h"
 #include "Geometry.h"
@@ -21,6 +22,11 @@ using namespace opengl;
 
 namespace opengl {
 
+struct ShaderSources {
+    std::string vertex;
+    std::string fragment;
+};
+
 class RenderingEngine {
 public:
     RenderingEngine();
@@ -29,8 +35,11 @@ public:
     void assignBuffer(Geometry &geometry);
     void deleteBuffer(Geometry &geometry);
     void setBufferData(Geometry &geometry);
+    void uploadVertices(Geometry &geometry);
 
     bool reloadShadersFromFile(std::vector<opengl::Program> &g_program);
+    bool loadShaderSources(ShaderSources &sources); // file reads only, safe off the GL thread
+    bool buildShaders(ShaderSources const &sources, std::vector<opengl::Program> &g_program);
 };
 
 } // namespace openGL
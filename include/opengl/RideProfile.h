@@ -0,0 +1,74 @@
+/**
+ * Author: Glenn Skelton
+ *
+ * Offline analysis of the whole ride. For every arc length sample of the track
+ * the speed from the phase model of v() is combined with the exact curvature of
+ * the spline to give the forces the riders feel along, up through and across
+ * the track, and how quickly they change. The samples are independent so the
+ * track is split into chunks across the thread pool.
+ */
+
+
+#ifndef RIDEPROFILE_H
+#define RIDEPROFILE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "CoasterPhysics.h"
+
+namespace util {
+class ThreadPool;
+}
+
+namespace math {
+namespace physics {
+
+// forces felt at one curve point in units of standard gravity, the normal force
+// is positive into the seat and tangential is positive when speeding up
+struct RideSample {
+    float s; // arc length from the start of the curve
+    float speed;
+    float tangentialG;
+    float normalG;
+    float lateralG;
+    float jerk; // rate of change of the felt force, g per second
+    uint8_t phase;
+};
+
+// largest or smallest value of one quantity and where on the track it is
+struct ProfileExtremum {
+    double value = 0.0;
+    double s = 0.0;
+};
+
+struct ProfileSummary {
+    ProfileExtremum maxSpeed;
+    ProfileExtremum maxTangentialG; // hardest acceleration
+    ProfileExtremum minTangentialG; // hardest braking
+    ProfileExtremum maxNormalG;
+    ProfileExtremum minNormalG; // negative when riders are lifted out of their seats
+    ProfileExtremum maxLateralG; // either direction
+    ProfileExtremum maxJerk;
+};
+
+struct RideProfile {
+    PhysicsParameters parameters;
+    PhaseLayout phases;
+    vector<RideSample> samples; // one per curve point
+    ProfileSummary summary;
+};
+
+RideProfile analyzeRide(const Track &track,
+                        const SimulationContext &context,
+                        const TrackFrames &frames,
+                        util::ThreadPool &pool);
+ProfileSummary summarizeProfile(const vector<RideSample> &samples);
+bool writeProfileCSV(const string &filePath, const RideProfile &profile);
+bool writeProfileBinary(const string &filePath, const RideProfile &profile);
+
+} // namespace physics
+} // namespace math
+
+#endif // RIDEPROFILE_H
@@ -0,0 +1,71 @@
+/**
+ * Author: Glenn Skelton
+ *
+ * Height statistics of a track, computed once when it is loaded. Besides the
+ * highest and lowest points of the whole track it answers the highest and
+ * lowest point between any two curve points or arc lengths in constant time,
+ * for checks over single hills or sections. The curve is split into blocks
+ * with the best point from the start and end of every block kept per point,
+ * and a sparse table over the blocks covers whatever lies between.
+ */
+
+
+#ifndef TRACKSTATS_H
+#define TRACKSTATS_H
+
+#include <vector>
+
+#include "curve.h"
+
+namespace math {
+namespace physics {
+
+struct HeightSample {
+    unsigned int index = 0; // curve point, the earliest one on ties
+    float height = 0.f;
+};
+
+class TrackStats {
+public:
+    TrackStats();
+    explicit TrackStats(const math::geometry::Curve &curve);
+
+    unsigned int pointCount() const;
+
+    // whole track
+    HeightSample highest() const;
+    HeightSample lowest() const;
+
+    // points first to last inclusive, wrapping past the end when last < first
+    HeightSample highest(unsigned int first, unsigned int last) const;
+    HeightSample lowest(unsigned int first, unsigned int last) const;
+
+    // points with arc lengths from s0 to s1 going forward, wrapping past the end when s1 < s0
+    HeightSample highestBetween(double s0, double s1) const;
+    HeightSample lowestBetween(double s0, double s1) const;
+
+private:
+    struct Table {
+        std::vector<unsigned int> fromBlockStart; // best point from the start of its block up to each point
+        std::vector<unsigned int> toBlockEnd; // best point from each point to the end of its block
+        std::vector<std::vector<unsigned int>> blocks; // level k holds the best of 2^k blocks from each block
+    };
+
+    template <typename Better>
+    void build(Table &table, Better better) const;
+    template <typename Better>
+    unsigned int query(const Table &table, Better better, unsigned int first, unsigned int last) const;
+    double wrap(double s) const;
+    unsigned int pointAt(double s) const;
+    void pointsBetween(double s0, double s1, unsigned int &first, unsigned int &last) const;
+
+    std::vector<float> m_heights;
+    double m_deltaS = 0.0; // arc length between points
+    Table m_highest;
+    Table m_lowest;
+};
+
+} // namespace physics
+} // namespace math
+
+#endif // TRACKSTATS_H
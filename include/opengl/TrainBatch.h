@@ -0,0 +1,71 @@
+/**
+ * Author: Glenn Skelton
+ *
+ * Steps many independent trains on one track at once. The train states are
+ * kept as a structure of arrays and the phase logic of v() is folded into a
+ * per point speed table, so a step is a pass of table lookups followed by an
+ * SSE2 advance of the positions, and it splits cleanly across threads.
+ */
+
+
+#ifndef TRAINBATCH_H
+#define TRAINBATCH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "CoasterPhysics.h"
+
+namespace util {
+class ThreadPool;
+}
+
+namespace math {
+namespace physics {
+
+// v() at every curve point written as speed = base + brake * fallVelocity
+struct SpeedTable {
+    SpeedTable();
+    explicit SpeedTable(const SimulationContext &context);
+
+    vector<double> base; // lift, station or free fall speed, zero while braking
+    vector<double> brake; // fraction of the fall speed left while braking, else zero
+    vector<uint8_t> phase; // PHASE of every point
+};
+
+class TrainBatch {
+public:
+    TrainBatch();
+    explicit TrainBatch(const SimulationContext &context); // context must outlive the batch
+
+    size_t size() const;
+    void addTrain(const TrainState &state);
+    TrainState train(size_t i) const; // AoS copy of one train
+    void clear();
+
+    void step(double dt);
+    void step(double dt, util::ThreadPool &pool);
+
+    // per train arrays
+    double const *s() const;
+    double const *velocity() const;
+    unsigned int const *index() const;
+
+private:
+    void stepRange(size_t begin, size_t end, double dt);
+
+    const SimulationContext *m_context = nullptr;
+    SpeedTable m_speeds;
+
+    vector<double> m_s;
+    vector<double> m_velocity;
+    vector<double> m_fallVelocity;
+    vector<unsigned int> m_index;
+    vector<uint8_t> m_phase;
+};
+
+} // namespace physics
+} // namespace math
+
+#endif // TRAINBATCH_H
@@ -0,0 +1,57 @@
+/**
+ * Author: Glenn Skelton
+ *
+ * Fixed size lock free queue for passing small messages from exactly one
+ * producer thread to exactly one consumer thread. Each side owns one index of
+ * a ring buffer and only reads the other's, so neither side ever waits. A push
+ * onto a full queue fails rather than blocking the producer.
+ */
+
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+namespace util {
+
+template <typename T, size_t Capacity>
+class SpscQueue {
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+
+public:
+    SpscQueue() = default;
+
+    SpscQueue(SpscQueue const &) = delete;
+    SpscQueue &operator=(SpscQueue const &) = delete;
+
+    // producer side, false when the queue is full
+    bool push(T const &item) {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_head.load(std::memory_order_acquire) == Capacity)
+            return false;
+        m_items[tail & (Capacity - 1)] = item;
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer side, false when the queue is empty
+    bool pop(T &item) {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail.load(std::memory_order_acquire))
+            return false;
+        item = m_items[head & (Capacity - 1)];
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer side, nothing left to pop
+    bool empty() const { return m_head.load(std::memory_order_relaxed) == m_tail.load(std::memory_order_acquire); }
+
+private:
+    T m_items[Capacity];
+    alignas(64) std::atomic<size_t> m_head{0}; // next item to pop, written by the consumer
+    alignas(64) std::atomic<size_t> m_tail{0}; // next free slot, written by the producer
+};
+
+} // namespace util
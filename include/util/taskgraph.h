@@ -0,0 +1,66 @@
+/**
+ * Author: Glenn Skelton
+ *
+ * A set of tasks with dependencies between them, run on a thread pool. A task
+ * is queued as soon as everything it depends on has finished, so independent
+ * chains run side by side and the whole graph takes about as long as its
+ * longest chain. A task that fails skips everything that depends on it.
+ * Other threads can watch a run in progress through finished().
+ */
+
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace util {
+
+class ThreadPool;
+
+class TaskGraph {
+public:
+    using TaskId = size_t;
+
+    // fn returns false on failure, dependencies must already be in the graph
+    TaskId add(std::string name, std::function<bool()> fn, std::vector<TaskId> const &dependencies = {});
+
+    // run every task, the calling thread helps and returns once all are done,
+    // true when none failed or were skipped
+    bool run(ThreadPool &pool);
+
+    size_t size() const;
+    std::string const &name(TaskId task) const;
+    bool finished(TaskId task) const; // done or skipped in the current run, safe from any thread
+    size_t finishedCount() const;
+    bool succeeded(TaskId task) const; // only once finished
+    double seconds(TaskId task) const; // time the task itself took in the last run
+
+    double totalSeconds() const; // every task one after the other
+    double longestChainSeconds() const; // the slowest path through the dependencies
+
+private:
+    struct Task {
+        std::string name;
+        std::function<bool()> fn;
+        std::vector<TaskId> dependencies;
+        std::vector<TaskId> dependents;
+        bool succeeded = false;
+        double seconds = 0.0;
+
+        std::atomic<size_t> waitingOn{0}; // dependencies that have not finished
+        std::atomic<bool> skipped{false};
+        std::atomic<bool> finished{false};
+    };
+
+    void queue(ThreadPool &pool, TaskId id);
+
+    std::deque<Task> m_tasks; // never moves a task, they hold atomics
+    std::atomic<size_t> m_finished{0};
+};
+
+} // namespace util
@@ -0,0 +1,68 @@
+/**
+ * Author: Glenn Skelton
+ *
+ * Small fixed size thread pool used to split data parallel loops (curve
+ * subdivision, track analysis, mesh generation) across the available cores.
+ * Every worker has its own queue: it runs its newest task first, which keeps
+ * nested work close together, and when it runs dry it steals the oldest task
+ * from another queue. Threads outside the pool submit to a shared queue.
+ */
+
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace util {
+
+class ThreadPool {
+public:
+    explicit ThreadPool(size_t threadCount = std::thread::hardware_concurrency());
+    ~ThreadPool();
+
+    ThreadPool(ThreadPool const &) = delete;
+    ThreadPool &operator=(ThreadPool const &) = delete;
+
+    size_t threadCount() const;
+
+    void submit(std::function<void()> task);
+
+    // Split [0, count) into contiguous chunks of at least minChunk items and run
+    // fn(begin, end) on each, blocking until every chunk has finished. The calling
+    // thread helps out, so it is safe to call from inside a pool task.
+    void parallelFor(size_t count, std::function<void(size_t, size_t)> const &fn, size_t minChunk = 1);
+
+    // Run one queued task on the calling thread, false when there was none. For
+    // callers that wait on work in the pool and should help rather than sleep.
+    bool runPendingTask();
+
+private:
+    struct WorkQueue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    size_t homeQueue() const;
+    bool takeTask(size_t queue, bool newest, std::function<void()> &task);
+    void workerLoop(size_t queue);
+
+    std::vector<std::thread> m_workers;
+    std::vector<std::unique_ptr<WorkQueue>> m_queues; // one per worker, the last is shared by other threads
+    std::atomic<size_t> m_queued{0}; // tasks waiting in any queue
+    std::mutex m_mutex; // only guards sleeping and stopping
+    std::condition_variable m_wake;
+    bool m_stopping = false;
+};
+
+// pool shared by the whole program, sized to the hardware
+ThreadPool &defaultThreadPool();
+
+} // namespace util
@@ -0,0 +1,57 @@
+/**
+ * Author: Glenn Skelton
+ *
+ * Lock free handoff of the latest value from one writer thread to one reader
+ * thread. There are three slots: the writer fills its own back slot and swaps
+ * it with the shared middle slot, and the reader swaps its front slot with the
+ * middle one whenever something new has been published. Neither side ever
+ * waits for the other, the reader simply keeps the newest complete value and
+ * anything the writer publishes in between is dropped.
+ */
+
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+namespace util {
+
+template <typename T>
+class TripleBuffer {
+public:
+    TripleBuffer() = default;
+    explicit TripleBuffer(T const &initial) : m_slots{initial, initial, initial} {}
+
+    TripleBuffer(TripleBuffer const &) = delete;
+    TripleBuffer &operator=(TripleBuffer const &) = delete;
+
+    // writer side, fill back() completely then publish() it
+    T &back() { return m_slots[m_back]; }
+    void publish() {
+        uint8_t previous = m_middle.exchange(m_back | FRESH, std::memory_order_acq_rel);
+        m_back = previous & INDEX;
+    }
+
+    // reader side, update() takes the newest published value if there is one
+    // and returns whether front() changed
+    bool update() {
+        if (!(m_middle.load(std::memory_order_relaxed) & FRESH))
+            return false;
+        uint8_t previous = m_middle.exchange(m_front, std::memory_order_acq_rel);
+        m_front = previous & INDEX;
+        return true;
+    }
+    T const &front() const { return m_slots[m_front]; }
+
+private:
+    static const uint8_t INDEX = 0x3;
+    static const uint8_t FRESH = 0x4; // set when the middle slot has not been read yet
+
+    T m_slots[3];
+    uint8_t m_back = 0; // only touched by the writer
+    std::atomic<uint8_t> m_middle{1};
+    uint8_t m_front = 2; // only touched by the reader
+};
+
+} // namespace util
@@ -0,0 +1,220 @@
+/**
+ * Author: Glenn Skelton
+ *
+ * Closed uniform cubic B-spline defined by the control points of a track file.
+ * This is the limit curve of cubicSubdivideCurve(), evaluated in closed form so
+ * the track can be sampled at any parameter without materializing subdivisions.
+ */
+
+
+#include "bsplinecurve.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace math {
+namespace geometry {
+
+namespace {
+
+// weights a control point contributes to a segment at local parameter u
+struct Basis {
+    double b[4];
+};
+
+Basis positionBasis(double u) {
+    double u2 = u * u;
+    double u3 = u2 * u;
+    double w = 1.0 - u;
+    return {{w * w * w / 6.0,
+             (3.0 * u3 - 6.0 * u2 + 4.0) / 6.0,
+             (-3.0 * u3 + 3.0 * u2 + 3.0 * u + 1.0) / 6.0,
+             u3 / 6.0}};
+}
+
+Basis firstDerivativeBasis(double u) {
+    double u2 = u * u;
+    double w = 1.0 - u;
+    return {{-0.5 * w * w,
+             1.5 * u2 - 2.0 * u,
+             -1.5 * u2 + u + 0.5,
+             0.5 * u2}};
+}
+
+Basis secondDerivativeBasis(double u) { return {{1.0 - u, 3.0 * u - 2.0, -3.0 * u + 1.0, u}}; }
+
+// blend the four control points of segment j, accumulating in double
+Vec3f combine(Points const &controlPoints, size_t j, Basis const &basis) {
+    size_t n = controlPoints.size();
+    double p[3] = {0.0, 0.0, 0.0};
+    for (size_t k = 0; k < 4; ++k) {
+        Vec3f const &c = controlPoints[(j + k) % n];
+        p[0] += basis.b[k] * c.m_x;
+        p[1] += basis.b[k] * c.m_y;
+        p[2] += basis.b[k] * c.m_z;
+    }
+    return Vec3f((float)p[0], (float)p[1], (float)p[2]);
+}
+
+// 5 point Gauss-Legendre abscissae and weights on [-1, 1]
+const double GAUSS_X[5] = {0.0, -0.5384693101056831, 0.5384693101056831, -0.9061798459386640, 0.9061798459386640};
+const double GAUSS_W[5] = {0.5688888888888889, 0.4786286704993665, 0.4786286704993665, 0.2369268850561891, 0.2369268850561891};
+
+// widest parameter interval integrated with a single quadrature
+const double MAX_QUADRATURE_STEP = 0.125;
+
+} // namespace
+
+BSplineCurve::BSplineCurve() {}
+
+BSplineCurve::BSplineCurve(Points controlPoints) : m_controlPoints(std::move(controlPoints)) {}
+
+BSplineCurve::BSplineCurve(Curve const &controlPolygon) : m_controlPoints(controlPolygon.points()) {}
+
+/**
+ * Find the segment containing t (wrapped into range) and its local parameter u.
+ */
+size_t BSplineCurve::segmentOf(double t, double &u) const {
+    double n = (double)m_controlPoints.size();
+    if (t < 0.0 || t >= n) { // only wrap when needed, fmod is slow
+        t = std::fmod(t, n);
+        if (t < 0.0) {
+            t += n;
+        }
+    }
+    double segment = std::floor(t);
+    u = t - segment;
+
+    size_t j = (size_t)segment;
+    return j >= m_controlPoints.size() ? 0 : j;
+}
+
+Vec3f BSplineCurve::position(double t) const {
+    double u;
+    size_t j = segmentOf(t, u);
+    Basis basis = positionBasis(u);
+
+    return combine(m_controlPoints, j, basis);
+}
+
+Vec3f BSplineCurve::firstDerivative(double t) const {
+    double u;
+    size_t j = segmentOf(t, u);
+    Basis basis = firstDerivativeBasis(u);
+
+    return combine(m_controlPoints, j, basis);
+}
+
+Vec3f BSplineCurve::secondDerivative(double t) const {
+    double u;
+    size_t j = segmentOf(t, u);
+    Basis basis = secondDerivativeBasis(u);
+
+    return combine(m_controlPoints, j, basis);
+}
+
+size_t BSplineCurve::segmentCount() const { return m_controlPoints.size(); }
+
+Points const &BSplineCurve::controlPoints() const { return m_controlPoints; }
+
+// Free functions
+
+/**
+ * Length of the spline between parameters t0 and t1 (t1 >= t0), integrating the
+ * speed |C'(t)| with Gauss-Legendre quadrature over short sub intervals.
+ */
+double arcLength(BSplineCurve const &spline, double t0, double t1) {
+    if (spline.segmentCount() == 0 || t1 <= t0) {
+        return 0.0;
+    }
+
+    int steps = (int)std::ceil((t1 - t0) / MAX_QUADRATURE_STEP);
+    double h = (t1 - t0) / steps;
+    double l = 0.0;
+
+    for (int i = 0; i < steps; ++i) {
+        double mid = t0 + (i + 0.5) * h;
+        for (int k = 0; k < 5; ++k) {
+            l += GAUSS_W[k] * norm(spline.firstDerivative(mid + 0.5 * h * GAUSS_X[k]));
+        }
+    }
+    return 0.5 * h * l;
+}
+
+double length(BSplineCurve const &spline) { return arcLength(spline, 0.0, (double)spline.segmentCount()); }
+
+namespace {
+
+/**
+ * Bisect [t0, t1] until the piece is flat enough, pushing the start of every
+ * accepted piece. The chord error is measured at the quarter points as well as
+ * the midpoint so an S bend whose midpoint happens to sit on the chord is still
+ * refined.
+ */
+void refinePiece(BSplineCurve const &spline,
+                 double t0, Vec3f const &p0, Vec3f const &d0,
+                 double t1, Vec3f const &p1, Vec3f const &d1,
+                 float chordTolerance, float cosAngleTolerance,
+                 int depth, int maxDepth,
+                 Points &points, std::vector<double> &parameters) {
+    double tm = 0.5 * (t0 + t1);
+    Vec3f pm = spline.position(tm);
+
+    bool flat = depth >= maxDepth;
+    if (!flat) {
+        Vec3f chord = p1 - p0;
+        float chordLengthSquared = normSquared(chord);
+        float err = 0.f;
+        for (double u : {0.25, 0.5, 0.75}) {
+            Vec3f p = u == 0.5 ? pm : spline.position(t0 + u * (t1 - t0));
+            Vec3f offset = p - p0;
+            float along = chordLengthSquared > 0.f ? (offset * chord) / chordLengthSquared : 0.f;
+            err = std::max(err, distance(p, p0 + chord * along));
+        }
+        float cosAngle = normalized(d0) * normalized(d1);
+        flat = err <= chordTolerance && cosAngle >= cosAngleTolerance;
+    }
+
+    if (flat) {
+        points.push_back(p0);
+        parameters.push_back(t0);
+        return;
+    }
+
+    Vec3f dm = spline.firstDerivative(tm);
+    refinePiece(spline, t0, p0, d0, tm, pm, dm, chordTolerance, cosAngleTolerance, depth + 1, maxDepth, points, parameters);
+    refinePiece(spline, tm, pm, dm, t1, p1, d1, chordTolerance, cosAngleTolerance, depth + 1, maxDepth, points, parameters);
+}
+
+} // namespace
+
+/**
+ * Sample the spline with as few points as the tolerances allow. Straight runs
+ * keep a single point per segment while tight bends are refined, so the point
+ * count follows the geometric complexity of the track rather than a fixed depth.
+ */
+ParameterizedCurve adaptiveSubdivideCurve(BSplineCurve const &spline,
+                                          float chordTolerance,
+                                          float angleTolerance,
+                                          int maxDepth) {
+    ParameterizedCurve result;
+    Points points;
+    size_t segments = spline.segmentCount();
+    float cosAngleTolerance = std::cos(angleTolerance * float(M_PI) / 180.f);
+
+    for (size_t j = 0; j < segments; ++j) {
+        double t0 = (double)j;
+        double t1 = (double)(j + 1);
+        refinePiece(spline,
+                    t0, spline.position(t0), spline.firstDerivative(t0),
+                    t1, spline.position(t1), spline.firstDerivative(t1),
+                    chordTolerance, cosAngleTolerance, 0, maxDepth,
+                    points, result.parameters);
+    }
+
+    result.curve = Curve(std::move(points), true);
+    return result;
+}
+
+} // namespace geometry
+} // namespace math
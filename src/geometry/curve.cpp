@@ -8,23 +8,28 @@
 
 #include "curve.h"
 
+#include <algorithm>
+
 namespace math {
 namespace geometry {
 
 Curve::Curve() {}
 
-Curve::Curve(std::vector<Vec3f> points) : m_points(points) {}
-Curve::Curve(std::vector<Vec3f> points, bool isClosedCurve) : m_points(points), m_isClosedCurve(isClosedCurve) {}
+Curve::Curve(std::vector<Vec3f> points) : m_points(std::move(points)) { rebuildArcLengths(); }
+Curve::Curve(std::vector<Vec3f> points, bool isClosedCurve) : m_points(std::move(points)), m_isClosedCurve(isClosedCurve) {
+    rebuildArcLengths();
+}
 
 Vec3f Curve::operator[](int idx) const { return m_points[idx]; }
 
-Vec3f &Curve::operator[](int idx) { return m_points[idx]; }
-
 Vec3f Curve::front() const { return m_points.front(); }
 
 Vec3f Curve::back() const { return m_points.back(); }
 
-void Curve::setPoint(int idx, Vec3f point) { m_points.at(idx) = point; }
+void Curve::setPoint(int idx, Vec3f point) {
+    m_points.at(idx) = point;
+    rebuildArcLengths();
+}
 
 void Curve::addMidpointToSegment(int idx) {
     Vec3f a = m_points[idx];
@@ -35,9 +40,13 @@ void Curve::addMidpointToSegment(int idx) {
     Vec3f c = lerp(a, b, 0.5f);
     // TODO: std::advance wasn't working?
     m_points.insert(std::begin(m_points) + neighbourIdx, c);
+    rebuildArcLengths();
 }
 
-void Curve::removePoint(int idx) { m_points.erase(std::begin(m_points) + idx); }
+void Curve::removePoint(int idx) {
+    m_points.erase(std::begin(m_points) + idx);
+    rebuildArcLengths();
+}
 
 size_t Curve::pointCount() const { return m_points.size(); }
 
@@ -45,66 +54,139 @@ Vec3f const *Curve::data() const { return m_points.data(); }
 
 std::vector<Vec3f> const &Curve::points() const { return m_points; }
 
+CurveSoA const &Curve::soa() const { return m_soa; }
+
 bool Curve::isClosed() const { return m_isClosedCurve; }
 
-void Curve::setClosed(bool closed) { m_isClosedCurve = closed; }
+void Curve::setClosed(bool closed) {
+    m_isClosedCurve = closed;
+    rebuildArcLengths();
+}
 
-// Free functions
-float length(Curve const &curve) {
-    float l = 0.f;
-    int numLineSegments = curve.pointCount() - 1;
+double Curve::length() const { return m_length; }
 
-    for (int i = 0; i < numLineSegments; ++i) {
-        l += distance(curve[i], curve[i + 1]);
-    }
+double Curve::arcLength(size_t idx) const { return arcLengths()[idx]; }
 
-    if (curve.isClosed()) { // do wrap around segment
-        l += distance(curve.front(), curve.back());
-    }
+std::vector<double> const &Curve::arcLengths() const { return m_arcLengths; }
 
-    return l;
+/**
+ * Index of the point that starts the segment containing arc length s, found
+ * by binary search over the prefix sums. Values past the last point land in
+ * the last point (the start of the wrap around segment for closed curves).
+ */
+size_t Curve::segmentAtArcLength(double s) const {
+    auto const &table = arcLengths();
+    if (table.empty()) {
+        return 0;
+    }
+    auto it = std::upper_bound(table.begin(), table.end(), s);
+    return it == table.begin() ? 0 : size_t(it - table.begin()) - 1;
 }
 
-Curve cubicSubdivideCurve(Curve curve, int numberOfSubdivisionSteps) {
-    for (int iter = 0; iter < numberOfSubdivisionSteps; ++iter) {
-        curve = repeatedAveraging(curve, 2);
+void Curve::rebuildArcLengths() {
+    m_soa = CurveSoA(m_points);
+    m_arcLengths.resize(m_points.size());
+
+    // segment lengths in vector lanes, then summed in order
+    std::vector<float> segments(m_points.size() > 1 ? m_points.size() - 1 : 0);
+    segmentLengths(m_soa, segments.data());
+
+    double l = 0.0; // accumulate in double, float drifts badly on dense curves
+    for (size_t i = 0; i < m_points.size(); ++i) {
+        if (i > 0) {
+            l += segments[i - 1];
+        }
+        m_arcLengths[i] = l;
     }
-    return curve;
-}
 
-Curve repeatedAveraging(Curve const &curve, int numberOfAveragingSteps) {
-    return {repeatedAveraging(curve.points(), numberOfAveragingSteps)};
+    if (m_isClosedCurve && !m_points.empty()) { // do wrap around segment
+        l += distance(m_points.front(), m_points.back());
+    }
+
+    m_length = l;
 }
 
-Points repeatedAveraging(Points points, int numberOfAveragingSteps) {
-    Points tmp;
-    tmp.reserve(points.size() * 2);
-    int numLineSegments = points.size() - 1;
+namespace {
 
-    for (int i = 0; i < numLineSegments; ++i) {
-        Vec3f mid = lerp(points[i], points[i + 1], 0.5f);
-        tmp.push_back(points[i]);
-        tmp.push_back(mid);
+// Ping-pong storage for subdivision, sized once for the final level so that
+// midpoint insertion and every averaging pass run without allocating
+struct SubdivisionBuffers {
+    SubdivisionBuffers(Points const &points, size_t finalCount)
+        : front(std::max(finalCount, points.size())), back(front.size()), count(points.size()) {
+        std::copy(points.begin(), points.end(), front.begin());
     }
-    Vec3f mid = lerp(points.back(), points.front(), 0.5f);
-    tmp.push_back(points.back());
-    tmp.push_back(mid);
 
-    points = tmp;
+    Points front; // current points, only the first count are live
+    Points back;  // scratch, swapped with front after every pass
+    size_t count = 0;
+};
+
+/**
+ * One subdivision level: insert the midpoint of every segment (including the
+ * wrap around segment) and then average neighbours, ping-ponging between the
+ * two buffers.
+ */
+void subdivideLevel(SubdivisionBuffers &buffers, int numberOfAveragingSteps) {
+    size_t n = buffers.count;
+    if (n == 0 || buffers.front.size() < n * 2) {
+        return;
+    }
+
+    Vec3f const *src = buffers.front.data();
+    Vec3f *dst = buffers.back.data();
+    for (size_t i = 0; i + 1 < n; ++i) {
+        dst[2 * i] = src[i];
+        dst[2 * i + 1] = lerp(src[i], src[i + 1], 0.5f);
+    }
+    dst[2 * n - 2] = src[n - 1];
+    dst[2 * n - 1] = lerp(src[n - 1], src[0], 0.5f);
+    buffers.front.swap(buffers.back);
+    n *= 2;
 
-    numLineSegments = points.size() - 1;
     for (int avgItr = 0; avgItr < numberOfAveragingSteps; ++avgItr) {
-        for (int i = 0; i < numLineSegments; ++i) {
-            Vec3f mid = lerp(points[i], points[i + 1], 0.5);
-            tmp[i] = mid;
+        src = buffers.front.data();
+        dst = buffers.back.data();
+        for (size_t i = 0; i + 1 < n; ++i) {
+            dst[i] = lerp(src[i], src[i + 1], 0.5f);
         }
-        Vec3f mid = lerp(points.back(), points.front(), 0.5f);
-        tmp.back() = mid;
+        dst[n - 1] = lerp(src[n - 1], src[0], 0.5f);
+        buffers.front.swap(buffers.back);
+    }
+
+    buffers.count = n;
+}
+
+} // namespace
+
+// Free functions
+float length(Curve const &curve) { return float(curve.length()); }
+
+Curve cubicSubdivideCurve(Curve const &curve, int numberOfSubdivisionSteps) {
+    if (curve.pointCount() == 0) {
+        return curve;
+    }
+
+    SubdivisionBuffers buffers(curve.points(), curve.pointCount() << numberOfSubdivisionSteps);
+    for (int iter = 0; iter < numberOfSubdivisionSteps; ++iter) {
+        subdivideLevel(buffers, 2);
+    }
+
+    buffers.front.resize(buffers.count);
+    return {std::move(buffers.front), curve.isClosed()};
+}
+
+Curve repeatedAveraging(Curve const &curve, int numberOfAveragingSteps) {
+    return {repeatedAveraging(curve.points(), numberOfAveragingSteps), curve.isClosed()};
+}
 
-        points.swap(tmp);
+Points repeatedAveraging(Points const &points, int numberOfAveragingSteps) {
+    if (points.empty()) {
+        return points;
     }
 
-    return points;
+    SubdivisionBuffers buffers(points, points.size() * 2);
+    subdivideLevel(buffers, numberOfAveragingSteps);
+    return std::move(buffers.front);
 }
 
 } // namespace geometry
@@ -10,11 +10,25 @@
 #include "curvefileio.h"
 
 #include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <iterator>
 #include <sstream>
 
+#ifdef _WIN32
+#define CURVE_CACHE_MMAP 0
+#include <process.h>
+#else
+#define CURVE_CACHE_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 namespace math {
 namespace geometry {
 
@@ -142,5 +156,166 @@ math::geometry::Curve loadCurveFrom_OBJ_File(std::string const &filePath) {
     return {points};
 }
 
+namespace {
+
+const char CACHE_MAGIC[8] = {'C', 'O', 'A', 'S', 'T', 'E', 'R', 'C'};
+const uint32_t CACHE_VERSION = 1;
+const uint64_t FNV_PRIME = 1099511628211ull;
+
+struct CacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t closed;
+    uint64_t key;
+    uint64_t pointCount;
+    uint64_t parameterCount;
+};
+
+// id of this process, keeps the temporary cache files of two programs apart
+int processId() {
+#ifdef _WIN32
+    return _getpid();
+#else
+    return getpid();
+#endif
+}
+
+/**
+ * Check the header and copy the payload of a cache file that is already in
+ * memory (mapped or read).
+ */
+bool readCachePayload(char const *bytes, size_t size, uint64_t key, Curve &curve, std::vector<double> &parameters) {
+    if (size < sizeof(CacheHeader)) {
+        return false;
+    }
+
+    CacheHeader header;
+    std::memcpy(&header, bytes, sizeof(header));
+    if (std::memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 || header.version != CACHE_VERSION ||
+        header.key != key) {
+        return false;
+    }
+
+    size_t pointBytes = header.pointCount * sizeof(Vec3f);
+    size_t parameterBytes = header.parameterCount * sizeof(double);
+    if (size != sizeof(CacheHeader) + pointBytes + parameterBytes) {
+        return false; // truncated or padded, do not trust it
+    }
+
+    Points points(header.pointCount);
+    std::memcpy(points.data(), bytes + sizeof(CacheHeader), pointBytes);
+    parameters.resize(header.parameterCount);
+    std::memcpy(parameters.data(), bytes + sizeof(CacheHeader) + pointBytes, parameterBytes);
+
+    curve = Curve(std::move(points), header.closed != 0);
+    return true;
+}
+
+} // namespace
+
+/**
+ * 64 bit FNV-1a hash of the bytes of a file, 0 if it can not be read.
+ */
+uint64_t hashFileContents(std::string const &filePath, uint64_t seed) {
+    std::ifstream file(filePath, std::ios::binary);
+    if (!file) {
+        return 0;
+    }
+
+    uint64_t hash = seed;
+    char buffer[4096];
+    while (file) {
+        file.read(buffer, sizeof(buffer));
+        for (std::streamsize i = 0; i < file.gcount(); ++i) {
+            hash = (hash ^ (unsigned char)buffer[i]) * FNV_PRIME;
+        }
+    }
+    return hash;
+}
+
+uint64_t hashCombine(uint64_t seed, uint64_t value) {
+    for (int i = 0; i < 8; ++i) {
+        seed = (seed ^ ((value >> (8 * i)) & 0xff)) * FNV_PRIME;
+    }
+    return seed;
+}
+
+bool saveCurveToCache(Curve const &curve, std::vector<double> const &parameters, uint64_t key, std::string const &filePath) {
+    CacheHeader header;
+    std::memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.version = CACHE_VERSION;
+    header.closed = curve.isClosed() ? 1 : 0;
+    header.key = key;
+    header.pointCount = curve.pointCount();
+    header.parameterCount = parameters.size();
+
+    // write next to the target and rename over it so a crash never leaves a torn cache
+    std::string tmpPath = filePath + "." + std::to_string(processId()) + ".tmp";
+    {
+        std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+        if (!file) {
+            std::cerr << "Unable to write cache " << tmpPath << '\n';
+            return false;
+        }
+        file.write(reinterpret_cast<char const *>(&header), sizeof(header));
+        file.write(reinterpret_cast<char const *>(curve.data()), curve.pointCount() * sizeof(Vec3f));
+        file.write(reinterpret_cast<char const *>(parameters.data()), parameters.size() * sizeof(double));
+        if (!file) {
+            std::cerr << "Unable to write cache " << tmpPath << '\n';
+            file.close();
+            std::remove(tmpPath.c_str());
+            return false;
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::rename(tmpPath, filePath, error); // replaces the old cache in one step
+    if (error) {
+        std::remove(tmpPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Load a processed curve from its cache file, memory mapping it where the
+ * platform allows. Returns false (leaving the outputs alone) on a miss.
+ */
+bool loadCurveFromCache(std::string const &filePath, uint64_t key, Curve &curve, std::vector<double> &parameters) {
+#if CURVE_CACHE_MMAP
+    int fd = open(filePath.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size <= 0) {
+        close(fd);
+        return false;
+    }
+
+    size_t size = (size_t)info.st_size;
+    void *mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        return false;
+    }
+
+    bool loaded = readCachePayload(static_cast<char const *>(mapped), size, key, curve, parameters);
+    munmap(mapped, size);
+    return loaded;
+#else
+    std::ifstream file(filePath, std::ios::binary | std::ios::ate);
+    if (!file) {
+        return false;
+    }
+
+    std::vector<char> bytes((size_t)file.tellg());
+    file.seekg(0);
+    file.read(bytes.data(), bytes.size());
+    return file && readCachePayload(bytes.data(), bytes.size(), key, curve, parameters);
+#endif
+}
+
 } // namespace geometry
 } // namespace math
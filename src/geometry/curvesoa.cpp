@@ -0,0 +1,195 @@
+/**
+ * Author: Glenn Skelton
+ *
+ * Structure of arrays copy of the points of a Curve and its vector kernels,
+ * see curvesoa.h.
+ */
+
+
+#include "curvesoa.h"
+
+#include <cmath>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define CURVE_SOA_SSE2 1
+#endif
+
+namespace math {
+namespace geometry {
+
+namespace {
+
+/*
+ * Thin wrapper over the widest vectors available so every kernel is written
+ * once. vfloat carries coordinates and vint the matching point indices.
+ */
+#if defined(__AVX2__)
+using vfloat = __m256;
+using vint = __m256i;
+const size_t LANES = 8;
+inline vfloat vload(float const *p) { return _mm256_loadu_ps(p); }
+inline void vstore(float *p, vfloat v) { _mm256_storeu_ps(p, v); }
+inline vfloat vsub(vfloat a, vfloat b) { return _mm256_sub_ps(a, b); }
+inline vfloat vadd(vfloat a, vfloat b) { return _mm256_add_ps(a, b); }
+inline vfloat vmul(vfloat a, vfloat b) { return _mm256_mul_ps(a, b); }
+inline vfloat vsqrt(vfloat a) { return _mm256_sqrt_ps(a); }
+inline vfloat vless(vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+inline vfloat vselect(vfloat mask, vfloat a, vfloat b) { return _mm256_blendv_ps(b, a, mask); }
+inline vint viset(int32_t s) { return _mm256_set1_epi32(s); }
+inline vint vilanes() { return _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7); }
+inline vint viadd(vint a, vint b) { return _mm256_add_epi32(a, b); }
+inline vint viselect(vfloat mask, vint a, vint b) { return _mm256_blendv_epi8(b, a, _mm256_castps_si256(mask)); }
+inline void vistore(int32_t *p, vint v) { _mm256_storeu_si256((__m256i *)p, v); }
+#elif defined(CURVE_SOA_SSE2)
+using vfloat = __m128;
+using vint = __m128i;
+const size_t LANES = 4;
+inline vfloat vload(float const *p) { return _mm_loadu_ps(p); }
+inline void vstore(float *p, vfloat v) { _mm_storeu_ps(p, v); }
+inline vfloat vsub(vfloat a, vfloat b) { return _mm_sub_ps(a, b); }
+inline vfloat vadd(vfloat a, vfloat b) { return _mm_add_ps(a, b); }
+inline vfloat vmul(vfloat a, vfloat b) { return _mm_mul_ps(a, b); }
+inline vfloat vsqrt(vfloat a) { return _mm_sqrt_ps(a); }
+inline vfloat vless(vfloat a, vfloat b) { return _mm_cmplt_ps(a, b); }
+inline vfloat vselect(vfloat mask, vfloat a, vfloat b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+inline vint viset(int32_t s) { return _mm_set1_epi32(s); }
+inline vint vilanes() { return _mm_setr_epi32(0, 1, 2, 3); }
+inline vint viadd(vint a, vint b) { return _mm_add_epi32(a, b); }
+inline vint viselect(vfloat mask, vint a, vint b) {
+    vint m = _mm_castps_si128(mask);
+    return _mm_or_si128(_mm_and_si128(m, a), _mm_andnot_si128(m, b));
+}
+inline void vistore(int32_t *p, vint v) { _mm_storeu_si128((__m128i *)p, v); }
+#else
+using vfloat = float;
+using vint = int32_t;
+const size_t LANES = 1;
+inline vfloat vload(float const *p) { return *p; }
+inline void vstore(float *p, vfloat v) { *p = v; }
+inline vfloat vsub(vfloat a, vfloat b) { return a - b; }
+inline vfloat vadd(vfloat a, vfloat b) { return a + b; }
+inline vfloat vmul(vfloat a, vfloat b) { return a * b; }
+inline vfloat vsqrt(vfloat a) { return std::sqrt(a); }
+inline bool vless(vfloat a, vfloat b) { return a < b; }
+inline vfloat vselect(bool mask, vfloat a, vfloat b) { return mask ? a : b; }
+inline vint viset(int32_t s) { return s; }
+inline vint vilanes() { return 0; }
+inline vint viadd(vint a, vint b) { return a + b; }
+inline vint viselect(bool mask, vint a, vint b) { return mask ? a : b; }
+inline void vistore(int32_t *p, vint v) { *p = v; }
+#endif
+
+// fold the lanes of a running best into one value, the earliest index wins ties
+template <typename Better>
+void reduceLanes(vfloat best, vint bestIndex, float &value, uint32_t &index, Better better) {
+    float lanes[LANES];
+    int32_t lanesIndex[LANES];
+    vstore(lanes, best);
+    vistore(lanesIndex, bestIndex);
+    for (size_t l = 0; l < LANES; ++l) {
+        uint32_t laneIndex = (uint32_t)lanesIndex[l];
+        if (better(lanes[l], value) || (lanes[l] == value && laneIndex < index)) {
+            value = lanes[l];
+            index = laneIndex;
+        }
+    }
+}
+
+} // namespace
+
+CurveSoA::CurveSoA() {}
+
+CurveSoA::CurveSoA(std::vector<Vec3f> const &points) : m_x(points.size()), m_y(points.size()), m_z(points.size()) {
+    for (size_t i = 0; i < points.size(); ++i) {
+        m_x[i] = points[i].m_x;
+        m_y[i] = points[i].m_y;
+        m_z[i] = points[i].m_z;
+    }
+}
+
+size_t CurveSoA::pointCount() const { return m_x.size(); }
+
+float const *CurveSoA::x() const { return m_x.data(); }
+float const *CurveSoA::y() const { return m_y.data(); }
+float const *CurveSoA::z() const { return m_z.data(); }
+
+// Free functions
+
+/**
+ * Length of every open segment. The differences, squares and sums run in the
+ * same order as norm(a - b) so the results match distance() exactly.
+ */
+void segmentLengths(CurveSoA const &curve, float *lengths) {
+    size_t n = curve.pointCount();
+    if (n < 2) {
+        return;
+    }
+
+    float const *x = curve.x();
+    float const *y = curve.y();
+    float const *z = curve.z();
+    size_t segments = n - 1;
+
+    size_t i = 0;
+    for (; i + LANES <= segments; i += LANES) {
+        vfloat dx = vsub(vload(x + i + 1), vload(x + i));
+        vfloat dy = vsub(vload(y + i + 1), vload(y + i));
+        vfloat dz = vsub(vload(z + i + 1), vload(z + i));
+        vstore(lengths + i, vsqrt(vadd(vadd(vmul(dx, dx), vmul(dy, dy)), vmul(dz, dz))));
+    }
+    for (; i < segments; ++i) {
+        float dx = x[i + 1] - x[i], dy = y[i + 1] - y[i], dz = z[i + 1] - z[i];
+        lengths[i] = std::sqrt(dx * dx + dy * dy + dz * dz);
+    }
+}
+
+/**
+ * Lowest and highest point of the curve (y), the first index wins ties.
+ */
+HeightExtrema heightExtrema(CurveSoA const &curve) {
+    HeightExtrema extrema;
+    size_t n = curve.pointCount();
+    if (n == 0) {
+        return extrema;
+    }
+
+    float const *y = curve.y();
+    extrema.minHeight = extrema.maxHeight = y[0];
+
+    size_t i = 0;
+    if (n >= LANES) {
+        vfloat lo = vload(y), hi = lo;
+        vint loIndex = vilanes(), hiIndex = loIndex;
+        vint index = loIndex;
+        vint step = viset((int32_t)LANES);
+        for (i = LANES; i + LANES <= n; i += LANES) {
+            vfloat v = vload(y + i);
+            index = viadd(index, step);
+            auto lower = vless(v, lo);
+            auto higher = vless(hi, v);
+            lo = vselect(lower, v, lo);
+            loIndex = viselect(lower, index, loIndex);
+            hi = vselect(higher, v, hi);
+            hiIndex = viselect(higher, index, hiIndex);
+        }
+        reduceLanes(lo, loIndex, extrema.minHeight, extrema.minIndex, [](float a, float b) { return a < b; });
+        reduceLanes(hi, hiIndex, extrema.maxHeight, extrema.maxIndex, [](float a, float b) { return a > b; });
+    }
+    for (; i < n; ++i) {
+        if (y[i] < extrema.minHeight) {
+            extrema.minHeight = y[i];
+            extrema.minIndex = i;
+        }
+        if (y[i] > extrema.maxHeight) {
+            extrema.maxHeight = y[i];
+            extrema.maxIndex = i;
+        }
+    }
+    return extrema;
+}
+
+} // namespace geometry
+} // namespace math
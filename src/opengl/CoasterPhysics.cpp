@@ -6,14 +6,21 @@
  * and Andrew Owens tutorial notes from CPSC 587.
  */
 
+#include <fstream>
 #include <iostream>
+#include <sstream>
 #include <vector>
+#include <cassert>
 #include <cmath>
+#include <algorithm>
 
 #include "mat4f.h"
 #include "CoasterPhysics.h"
 #include "Geometry.h"
 #include "curve.h"
+#include "curvefileio.h"
+#include "bsplinecurve.h"
+#include "threadpool.h"
 
 #define DEBUG 0
 
@@ -24,30 +31,327 @@ using namespace std;
 
 /**************************************** ARC LENGTH PARAM FUNCTIONS ***********************************************/
 
+namespace {
+
+// quadrature intervals of the length table handed to the pool per task
+const size_t QUADRATURE_GRAIN = 256;
+
+// points placed per task while resampling, fixed so the output does not depend
+// on the number of threads
+const size_t RESAMPLE_BLOCK = 2048;
+
+} // namespace
+
 /**
- * To reparameterize the curve based on the subdivision value of N passed in.
+ * To reparameterize the spline directly into N points spaced evenly by arc length.
+ * The spline is adaptively subdivided into a table of parameter against distance,
+ * each target distance is binary searched in it and then refined with Newton
+ * steps so the points lie exactly on the spline. The spline parameter of every
+ * point is optionally returned so exact derivatives can be evaluated later.
+ * The quadrature of the table and the placement of the points are split
+ * across the thread pool.
  */
-math::geometry::Curve ttlArcLengthReParam(const math::geometry::Curve &curve, int N) {
-    vector<math::Vec3f> uValue; // store the distance for each point of deltaS
-    math::Vec3f Pcurr; // store current point each iteration
-    double deltaS = (double)length(curve) / (double)N; // length of delta S between points
-    double curLength = 0.0f; // starting point for getting distances
+math::geometry::Curve ttlArcLengthReParam(const math::geometry::BSplineCurve &spline,
+                                          int N,
+                                          vector<double> *parameters) {
+    using math::geometry::arcLength;
+
+    const float chordTolerance = 1e-4f; // resolution of the parameter/length table
+    const float angleTolerance = 2.0f; // degrees
+    const int newtonSteps = 2;
+
+    vector<math::Vec3f> uValue; // store the evenly spaced points
+    if (spline.segmentCount() == 0 || N <= 0)
+        return math::geometry::Curve(uValue, true);
+
+    util::ThreadPool &pool = util::defaultThreadPool();
+
+    // cumulative length at the adaptively chosen parameter values, the interval
+    // lengths are independent and only the running sum is serial
+    vector<double> tTable = adaptiveSubdivideCurve(spline, chordTolerance, angleTolerance).parameters;
+    tTable.push_back((double)spline.segmentCount()); // close the loop
+    int tableSize = tTable.size() - 1;
+    vector<double> sTable(tableSize + 1, 0.0);
+    pool.parallelFor(tableSize, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++)
+            sTable[i + 1] = arcLength(spline, tTable[i], tTable[i + 1]);
+    }, QUADRATURE_GRAIN);
+    for (int i = 0; i < tableSize; i++) {
+        sTable[i + 1] += sTable[i];
+    }
+    double deltaS = sTable.back() / (double)N; // length of delta S between points
+
+    uValue.resize(N);
+    vector<double> tValue(N);
+
+    // every block of points is placed in order, starting over from the table
+    size_t blocks = (N + RESAMPLE_BLOCK - 1) / RESAMPLE_BLOCK;
+    pool.parallelFor(blocks, [&](size_t firstBlock, size_t lastBlock) {
+        for (size_t b = firstBlock; b < lastBlock; b++) {
+            int prevInterval = -1;
+            double prevT = 0.0, prevS = 0.0; // last placed point, already exact
+
+            int blockEnd = (int)std::min((size_t)N, (b + 1) * RESAMPLE_BLOCK);
+            for (int k = (int)(b * RESAMPLE_BLOCK); k < blockEnd; k++) {
+                double s = k * deltaS; // target distance along the curve
+
+                // find the table interval containing s and take a linear first guess
+                int i = (int)(upper_bound(sTable.begin(), sTable.end(), s) - sTable.begin()) - 1;
+                i = std::min(std::max(i, 0), tableSize - 1);
+                double t0 = tTable[i];
+                double t1 = tTable[i + 1];
+                double segLength = sTable[i + 1] - sTable[i];
+                double t = t0 + (segLength > 0.0 ? (s - sTable[i]) / segLength : 0.0) * (t1 - t0);
+
+                // measure from the previous point when it is in the same interval so the
+                // quadrature only has to span one point spacing
+                double anchorT = i == prevInterval ? prevT : t0;
+                double anchorS = i == prevInterval ? prevS : sTable[i];
+
+                // refine so the arc length to the point is exact
+                for (int n = 0; n < newtonSteps; n++) {
+                    double speed = norm(spline.firstDerivative(t));
+                    if (speed <= 0.0)
+                        break;
+                    double err = anchorS + arcLength(spline, anchorT, t) - s;
+                    t = std::min(std::max(t - err / speed, t0), t1);
+                }
+
+                uValue[k] = spline.position(t);
+                tValue[k] = t;
+
+                prevInterval = i;
+                prevT = t;
+                prevS = s;
+            }
+        }
+    }, 1);
+
+    if (parameters)
+        *parameters = move(tValue);
+    return math::geometry::Curve(move(uValue), true);
+}
+
 
-    uValue.push_back(curve[0]); // store the first point
 
-    // iterate through and calculate all the u values for the new param. curve
-    for (unsigned int i = 1; i < curve.pointCount(); i++) {
-        Pcurr = curve[i];
-        math::Vec3f prev = curve[i-1];
-        curLength += distance(Pcurr, prev);
 
-        if (curLength >= deltaS) { // check to see if we have surpassed delta s
-            uValue.push_back(Pcurr);
-            curLength = 0.0f; // reset for next point
+/******************************************** TRACK LOADING ****************************************/
+
+/**
+ * Load the control points of a closed track from an .obj file, evaluate their
+ * limit spline and sample it every 1/samplesPerUnit of arc length. The sampled
+ * track is kept in cachePath and reused while the .obj file and the sampling
+ * are unchanged.
+ */
+bool loadTrack(const string &filePath,
+               const string &cachePath,
+               unsigned int samplesPerUnit,
+               Track &track) {
+    using namespace math::geometry;
+
+    Curve controlPoints = loadCurveFrom_OBJ_File(filePath); // load from .obj file
+    if (controlPoints.pointCount() == 0) {
+        cerr << "curve is empty" << endl;
+        return false;
+    }
+    controlPoints.setClosed(true); // the track is a loop
+    track.spline = BSplineCurve(controlPoints);
+
+    uint64_t key = hashFileContents(filePath);
+    key = hashCombine(key, REPARAM_VERSION);
+    key = hashCombine(key, samplesPerUnit);
+
+    if (!loadCurveFromCache(cachePath, key, track.curve, track.parameters)) {
+        track.curve = ttlArcLengthReParam(track.spline, (unsigned int)(length(track.spline) * samplesPerUnit), &track.parameters);
+        if (!saveCurveToCache(track.curve, track.parameters, key, cachePath))
+            cerr << "could not write track cache " << cachePath << endl;
+    }
+
+    vector<ArcRange> loops;
+    if (!loadPhaseLayout(getPhaseFilePath(filePath), track.curve.length(), track.phases, &loops))
+        return false;
+    track.loops.clear();
+    for (const ArcRange &loop : loops)
+        track.loops.push_back(getPointRange(track.curve, loop));
+    if (track.phases.empty()) {
+        cerr << "no phases for " << filePath << ", lifting to the highest point" << endl;
+        track.phases = defaultPhaseLayout(track.curve);
+    }
+    return true;
+}
+
+/**
+ * The phases of a track live next to it, with the extension changed to .phases
+ */
+string getPhaseFilePath(const string &trackFilePath) {
+    size_t dot = trackFilePath.find_last_of('.');
+    size_t slash = trackFilePath.find_last_of("/\\");
+    if (dot == string::npos || (slash != string::npos && dot < slash))
+        return trackFilePath + ".phases";
+    return trackFilePath.substr(0, dot) + ".phases";
+}
+
+/**
+ * Read the phases of a track, one "<phase> <start>" per line where phase is
+ * lift, fall, brake or station and start is the arc length it begins at. A
+ * "loop <start> <end>" line marks the arc lengths of a loop, those are only
+ * kept when loops is given. The layout is left empty when there is no file, a
+ * file that does not describe a valid layout is an error.
+ */
+bool loadPhaseLayout(const string &filePath, double length, PhaseLayout &phases, vector<ArcRange> *loops) {
+    phases.clear();
+    if (loops)
+        loops->clear();
+    ifstream file(filePath);
+    if (!file)
+        return true; // nothing given for this track
+
+    string line;
+    unsigned int lineNum = 0;
+    while (getline(file, line)) {
+        lineNum++;
+        line = line.substr(0, line.find('#')); // remove comments
+
+        istringstream ss(line);
+        string name;
+        PhaseRange range;
+        if (!(ss >> name))
+            continue; // blank line
+
+        if (name == "loop") {
+            ArcRange loop;
+            if (!(ss >> loop.start >> loop.end) || loop.start < 0.0 || loop.start > loop.end || loop.end >= length) {
+                cerr << filePath << ":" << lineNum << ": loop must be two increasing arc lengths in [0, " << length << ")" << endl;
+                return false;
+            }
+            if (loops)
+                loops->push_back(loop);
+            continue;
+        }
+
+        bool known = false;
+        for (PHASE phase : {LIFT, FALL, END, STATION}) {
+            if (name == getPhaseName(phase)) {
+                range.phase = phase;
+                known = true;
+            }
+        }
+        if (!known) {
+            cerr << filePath << ":" << lineNum << ": unknown phase " << name << endl;
+            return false;
+        }
+
+        if (!(ss >> range.start) || range.start < 0.0 || range.start >= length) {
+            cerr << filePath << ":" << lineNum << ": phase start must be an arc length in [0, " << length << ")" << endl;
+            return false;
         }
+        phases.push_back(range);
     }
 
-    return math::geometry::Curve(uValue, true);
+    sort(phases.begin(), phases.end(), [](const PhaseRange &a, const PhaseRange &b) { return a.start < b.start; });
+    for (unsigned int i = 1; i < phases.size(); i++) {
+        if (phases[i].start == phases[i - 1].start) {
+            cerr << filePath << ": two phases start at " << phases[i].start << endl;
+            return false;
+        }
+    }
+    if (phases.empty() || phases.size() > 255) {
+        cerr << filePath << ": a track needs between 1 and 255 phases" << endl;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * The curve points that lie within an arc length range, found through the even
+ * spacing of the points
+ */
+PointRange getPointRange(const math::geometry::Curve &curve, const ArcRange &range) {
+    PointRange points;
+    unsigned int count = curve.pointCount();
+    if (count == 0)
+        return points;
+
+    double deltaS = curve.length() / (double)count;
+    points.first = std::min((unsigned int)ceil(range.start / deltaS), count - 1);
+    points.last = std::min((unsigned int)floor(range.end / deltaS), count - 1);
+    return points;
+}
+
+/**
+ * Phases for a track that has none, the lift runs from the start of the curve
+ * to just past the highest point and the train falls the rest of the way.
+ */
+PhaseLayout defaultPhaseLayout(const math::geometry::Curve &curve) {
+    PhaseLayout phases = {{LIFT, 0.0}};
+    if (curve.pointCount() == 0)
+        return phases;
+
+    double top = getMaxIndex(curve) * curve.length() / curve.pointCount() + TOP_OVERRUN;
+    if (top < curve.length())
+        phases.push_back({FALL, top});
+    return phases;
+}
+
+
+
+
+/******************************************** TRACK PHASES ****************************************/
+
+/**
+ * Name of a phase as written in .phases files
+ */
+const char *getPhaseName(PHASE phase) {
+    switch (phase) {
+    case LIFT:
+        return "lift";
+    case FALL:
+        return "fall";
+    case END:
+        return "brake";
+    case STATION:
+        return "station";
+    }
+    return "unknown";
+}
+
+bool hasPhase(const PhaseLayout &phases, PHASE phase) {
+    for (const PhaseRange &range : phases) {
+        if (range.phase == phase)
+            return true;
+    }
+    return false;
+}
+
+/**
+ * Get the arc length the first section of the given phase starts at, 0 when
+ * the track has none.
+ */
+double getPhaseStart(const PhaseLayout &phases, PHASE phase) {
+    for (const PhaseRange &range : phases) {
+        if (range.phase == phase)
+            return range.start;
+    }
+    return 0.0;
+}
+
+/**
+ * Move the start of the first section of the given phase, which also moves the
+ * end of the section before it. Fails if the track has no such phase or the
+ * section would pass one of its neighbours.
+ */
+bool setPhaseStart(PhaseLayout &phases, PHASE phase, double start, double length) {
+    for (unsigned int i = 0; i < phases.size(); i++) {
+        if (phases[i].phase != phase)
+            continue;
+        if (start < 0.0 || start >= length)
+            return false;
+        if ((i > 0 && start <= phases[i - 1].start) || (i + 1 < phases.size() && start >= phases[i + 1].start))
+            return false;
+        phases[i].start = start;
+        return true;
+    }
+    return false;
 }
 
 
@@ -66,18 +370,9 @@ double getMaxHeight(const math::geometry::Curve &curve) {
  * Get the highest point on the roller coaster and return its index.
  */
 int getMaxIndex(const math::geometry::Curve &curve) {
-    double max = curve.pointCount() > 0 ? curve[0].m_y : -1.0f;
-    if (max < 0.0)
+    if (curve.pointCount() == 0 || curve[0].m_y < 0.0)
         return -1; // error in curve geometry
-    unsigned int index = 0;
-
-    for (unsigned int i = 0; i < curve.pointCount(); i++) {
-        if (curve[i].m_y > max) {
-            max = curve[i].m_y; // record the new talest height
-            index = i; // record the tallest index
-        }
-    }
-    return index;
+    return heightExtrema(curve.soa()).maxIndex; // vector scan, the first point wins ties
 }
 
 /**
@@ -91,26 +386,17 @@ double getMinHeight(const math::geometry::Curve &curve) {
  * Get the lowest point on the roller coaster and return its index.
  */
 int getMinIndex(const math::geometry::Curve &curve) {
-    double min = curve.pointCount() > 0 ? curve[0].m_y : -1.0f;
-    if (min < 0.0)
+    if (curve.pointCount() == 0 || curve[0].m_y < 0.0)
         return -1; // error in curve geometry
-    unsigned int index = 0;
-
-    for (unsigned int i = 0; i < curve.pointCount(); i++) {
-        if (curve[i].m_y < min) {
-            min = curve[i].m_y; // record the new talest height
-            index = i; // record the tallest index
-        }
-    }
-    return index;
+    return heightExtrema(curve.soa()).minIndex;
 }
 
 /**
  * Calculate the velocity of the train based on the conservation
  * of energy equation.
  */
-double getFreefallVelocity(double maxHeight, double curHeight) {
-    return sqrt(2 * GRAVITY * (maxHeight - curHeight));
+double getFreefallVelocity(double maxHeight, double curHeight, double gravity) {
+    return sqrt(2 * gravity * (maxHeight - curHeight));
 }
 
 /**
@@ -126,37 +412,164 @@ double getDecelerationVelocity(const math::Vec3f &startPos,
     return velocity * ((double)Ddec / (double)L);
 }
 
+/**************************************** SIMULATION STATE ***********************************************/
+
+SimulationContext::SimulationContext() {}
+
+SimulationContext::SimulationContext(const math::geometry::Curve &curve,
+                                     const PhaseLayout &phases,
+                                     const PhysicsParameters &parameters)
+    : curve(&curve), parameters(parameters) {
+    unsigned int count = curve.pointCount();
+    if (count == 0)
+        return;
+    length = curve.length(); // O(1) from the arc length table
+    deltaS = length / (double)count; // distance between each point
+
+    stats = std::make_shared<TrackStats>(curve); // the only full scan of the heights
+    HeightSample highest = stats->highest();
+    HeightSample lowest = stats->lowest();
+    maxIndex = highest.index;
+    maxHeight = highest.height;
+    minIndex = lowest.index;
+    minHeight = lowest.height;
+
+    setPhases(phases);
+}
+
 /**
- * Get the speed of the cart at the given index
+ * Replace the phases of the track, looking the phase of every point up once.
+ * Points before the first section belong to the last one as it wraps around
+ * the end of the track.
  */
-double v(const math::geometry::Curve &curve, unsigned int index) {
-    static double curVelocity = 0.0f;
-    PHASE phase;
-    uint cartOffset = 500; // add some length to line it up nicely
-    math::Vec3f pos = curve[index];
-    double speed;
+void SimulationContext::setPhases(const PhaseLayout &layout) {
+    phases = layout.empty() ? defaultPhaseLayout(*curve) : layout;
+
+    unsigned int count = curve->pointCount();
+    rangeOf.resize(count);
+    unsigned int range = phases.size() - 1;
+    unsigned int next = 0;
+    for (unsigned int i = 0; i < count; i++) {
+        while (next < phases.size() && phases[next].start <= i * deltaS)
+            range = next++;
+        rangeOf[i] = (uint8_t)range;
+    }
+}
+
+TrainState::TrainState() {}
 
-    // determine the current phase
-    if (index >= LIFT_START || index <= getMaxIndex(curve) + 150) // offset for making sure the roller coaster starts the fall sufficiently quickly
-        phase = LIFT;
-    else if (index >= DECEL_START && index <= LIFT_START)
-        phase = END;
-    else
-        phase = FALL;
+namespace {
 
+// first curve point inside the section of the given phase
+unsigned int firstPointOf(const SimulationContext &context, PHASE phase) {
+    unsigned int index = getIndex(context, getPhaseStart(context.phases, phase));
+    return getPhase(context, index) == phase ? index : (index + 1) % context.curve->pointCount();
+}
+
+} // namespace
+
+TrainState::TrainState(const SimulationContext &context) : TrainState(context, firstPointOf(context, LIFT)) {}
+
+TrainState::TrainState(const SimulationContext &context, unsigned int start)
+    : index(start), s(start * context.deltaS) {}
+
+/**
+ * Wrap an arc length into [0, length) of the closed track
+ */
+double wrapArcLength(const SimulationContext &context, double s) {
+    s = fmod(s, context.length);
+    return s < 0.0 ? s + context.length : s;
+}
+
+/**
+ * Blend between the arc lengths of two consecutive simulation states, going
+ * forward across the seam of the track when the later state has wrapped.
+ */
+double interpolateArcLength(const SimulationContext &context, double s0, double s1, double alpha) {
+    double ds = wrapArcLength(context, s1 - s0); // distance moved forward
+    return wrapArcLength(context, s0 + alpha * ds);
+}
+
+/**
+ * Get the curve point at or just before the arc length s
+ */
+unsigned int getIndex(const SimulationContext &context, double s) {
+    unsigned int count = context.curve->pointCount();
+    unsigned int index = (unsigned int)(wrapArcLength(context, s) / context.deltaS);
+    return index < count ? index : count - 1; // rounding at the very end of the track
+}
+
+/**
+ * Get the position on the track at arc length s, interpolated between the
+ * two curve points either side of it.
+ */
+math::Vec3f getPointAt(const SimulationContext &context, double s) {
+    const math::geometry::Curve &curve = *context.curve;
+    s = wrapArcLength(context, s);
+    unsigned int i = getIndex(context, s);
+    unsigned int next = (i + 1) % curve.pointCount();
+    float u = (float)(s / context.deltaS - i);
+    return lerp(curve[i], curve[next], u);
+}
+
+/**
+ * Get the point where the braking section of the given phase range starts
+ */
+math::Vec3f getBrakeStart(const SimulationContext &context, unsigned int range) {
+    return getPointAt(context, context.phases[range].start);
+}
+
+/**
+ * Get the point the braking section slows the train down towards, a little
+ * past the start of the next section to line it up nicely.
+ */
+math::Vec3f getBrakeEnd(const SimulationContext &context, unsigned int range) {
+    const PhaseRange &next = context.phases[(range + 1) % context.phases.size()];
+    return getPointAt(context, next.start + BRAKE_OVERRUN);
+}
+
+/**
+ * Get the section of the track the given index is in
+ */
+PHASE getPhase(const SimulationContext &context, unsigned int index) {
+    return context.phases[context.rangeOf[index]].phase;
+}
+
+/**
+ * Get how far past the start of its section the arc length s is
+ */
+double distanceIntoPhase(const SimulationContext &context, double s) {
+    const PhaseRange &range = context.phases[context.rangeOf[getIndex(context, s)]];
+    return wrapArcLength(context, s - range.start);
+}
+
+/**
+ * Get the speed of the cart at the given index. The speed at the end of the fall
+ * is recorded in the train state so the braking section can slow down from it.
+ */
+double v(const SimulationContext &context, TrainState &state, unsigned int index) {
+    const math::geometry::Curve &curve = *context.curve;
+    const PhysicsParameters &parameters = context.parameters;
+    math::Vec3f pos = curve[index];
+    double speed = 0.0; // a phase without a speed stops the train
 
     // get the speed based on the phase
-    switch(phase) {
+    switch(getPhase(context, index)) {
     case LIFT:
-        speed = LIFT_SPEED; // constant lift velocity
+        speed = parameters.liftSpeed; // constant lift velocity
         break;
     case FALL:
-        speed = getFreefallVelocity(getMaxHeight(curve), pos.m_y) + LIFT_SPEED / 2; // add a little extra to simiulate the speed coming of the chain
-        curVelocity = speed;
+        speed = getFreefallVelocity(context.maxHeight, pos.m_y, parameters.gravity) + parameters.liftSpeed / 2; // add a little extra to simiulate the speed coming of the chain
+        state.fallVelocity = speed;
         break;
-    case END:
+    case END: {
         // constant deceleration velocity
-        speed = getDecelerationVelocity(curve[DECEL_START], pos, curve[LIFT_START + cartOffset], curVelocity);
+        unsigned int range = context.rangeOf[index];
+        speed = getDecelerationVelocity(getBrakeStart(context, range), pos, getBrakeEnd(context, range), state.fallVelocity);
+        break;
+    }
+    case STATION:
+        speed = parameters.stationSpeed; // trains roll slowly through the platform
         break;
     }
 
@@ -167,27 +580,29 @@ double v(const math::geometry::Curve &curve, unsigned int index) {
 /**
  * Returns the index of the next position based on the speed being traveled.
  */
-unsigned int getPosition(const math::geometry::Curve &curve,
+unsigned int getPosition(const SimulationContext &context,
                          unsigned int cur,
                          double dv,
                          double dt) {
-    double deltaS = (double)length(curve) / (double)curve.pointCount(); // distance between each point
     double ds = getDistance(dv, dt); // get distance to travel
-    unsigned int index = cur + (unsigned int)(ds / deltaS); // get the index value and truncate to the index
+    unsigned int index = cur + (unsigned int)(ds / context.deltaS); // get the index value and truncate to the index
 #if DEBUG
     cout << "INDEX: " << index << endl;
 #endif
-    return index % curve.pointCount(); // wrap around if needed
+    return index % context.curve->pointCount(); // wrap around if needed
 }
 
 /**
  * To take the derivative of position based on the time stamp
- * to get the current positions velocity.
+ * to get the current positions velocity. The train state is a copy so looking
+ * ahead never changes the train itself.
  */
-math::Vec3f getVelocity(const math::geometry::Curve &curve,
+math::Vec3f getVelocity(const SimulationContext &context,
+                        TrainState state,
                         unsigned int cur,
                         double dt) {
-    unsigned int next = getPosition(curve, cur, v(curve, cur), dt);
+    const math::geometry::Curve &curve = *context.curve;
+    unsigned int next = getPosition(context, cur, v(context, state, cur), dt);
     return ((curve[next] - curve[cur]) / dt); // finite difference between current position and next
 }
 
@@ -195,17 +610,28 @@ math::Vec3f getVelocity(const math::geometry::Curve &curve,
  * To take the derivative of velocity to return the acceleration
  * of the current position.
  */
-math::Vec3f getAcceleration(const math::geometry::Curve &curve,
+math::Vec3f getAcceleration(const SimulationContext &context,
+                            TrainState state,
                             unsigned int cur,
                             double dt) {
-    unsigned int nextPos = getPosition(curve, cur, v(curve, cur), dt);
-    math::Vec3f next = getVelocity(curve, nextPos, dt);
-    math::Vec3f current = getVelocity(curve, cur, dt);
+    unsigned int nextPos = getPosition(context, cur, v(context, state, cur), dt);
+    math::Vec3f next = getVelocity(context, state, nextPos, dt);
+    math::Vec3f current = getVelocity(context, state, cur, dt);
 
     return (next - current) / dt; // finite difference between current velocity and next velocity
 
 }
 
+/**
+ * Move the train forward by one time step, updating its phase and speed.
+ */
+void stepTrain(const SimulationContext &context, TrainState &state, double dt) {
+    state.phase = getPhase(context, state.index);
+    state.velocity = v(context, state, state.index);
+    state.s = wrapArcLength(context, state.s + getDistance(state.velocity, dt)); // no truncation so slow sections never stall
+    state.index = getIndex(context, state.s);
+}
+
 /**
  * get the distance traveled based on the time stamp and projected
  * velocity
@@ -222,100 +648,122 @@ double getDistance(double velocity, double deltaTime) {
 
 /****************************** TRACK GENERATION **************************************/
 
+namespace {
+
+// mesh samples handed to the pool per task
+const size_t MESH_GRAIN = 64;
+
+// vertices a support adds at curve point i, there are none inside a loop
+unsigned int supportVertexCount(const TrackFrames &frames, const vector<PointRange> &loops, unsigned int i) {
+    for (const PointRange &loop : loops) {
+        if (i >= loop.first && i <= loop.last)
+            return 0;
+    }
+    return frames[i].normal.m_y < 0.0 ? 4 : 2;
+}
+
+} // namespace
+
 /**
- * To trace the track and figure out based on the each fixed point, what the
- * orientation of the track is.
+ * To generate the track ribbon from every so many points of the curve. Every
+ * sample writes its own pair of vertices into preallocated arrays, so the
+ * samples are split across the thread pool and the mesh is the same for any
+ * number of threads.
  */
 void generateTrack(const math::geometry::Curve &curve,
-                                  opengl::Geometry &track,
-                                  double deltaTime) {
+                   const TrackFrames &frames,
+                   opengl::Geometry &track) {
     const unsigned int granularity = 200; // how coarse the track is displayed
-    const double trackWidth = 0.05;
+    const float trackWidth = 0.05f;
 
-    math::Vec3f start1, start2;
-    math::Vec3f normal, tangent, binormal;
-    math::Vec3f cur, point;
+    unsigned int count = curve.pointCount();
+    if (count < 2 || frames.size() != count)
+        return;
 
     // go through every so many points to create a rought approximation of the track
-    for (unsigned int i = 0; i < curve.pointCount()-1; i += granularity) {
-        // get the normal, tangent and binormal
-        cur = curve[i]; // retrieve the point on the track
-        normal = getNormal(curve, i, deltaTime);
-        tangent = getTangent(curve, i, deltaTime);
-        binormal = cross(tangent, normal);
-        normal = cross(binormal, tangent); // make sure normal is indeed orthogonal
-
-        // create right side of track
-        point = cur + (normalized(binormal) * trackWidth); // add the points to get width
-        track.verts.push_back(point);
-        track.normals.push_back(normal);
-        start1 = i == 0 ? point : start1; // store the first point for later
-        // create left side of track
-        point = cur - (normalized(binormal) * trackWidth);
-        track.verts.push_back(point);
-        track.normals.push_back(normal);
-        start2 = i == 0 ? point : start2; // store the first point for later
+    size_t samples = (count - 2) / granularity + 1;
+    size_t base = track.vertices.size();
+    track.vertices.resize(base + 2 * samples + 2);
+    opengl::Vertex *vertices = track.vertices.data() + base;
+
+    util::defaultThreadPool().parallelFor(samples, [&](size_t begin, size_t end) {
+        for (size_t k = begin; k < end; k++) {
+            unsigned int i = k * granularity;
+            math::Vec3f side = normalized(frames[i].binormal) * trackWidth;
+
+            vertices[2 * k].position = curve[i] + side; // right side of track
+            vertices[2 * k + 1].position = curve[i] - side; // left side of track
+            vertices[2 * k].normal = frames[i].normal;
+            vertices[2 * k + 1].normal = frames[i].normal;
+        }
+    }, MESH_GRAIN);
 
-    }
     // complete the loop
-    track.verts.push_back(start1);
-    track.normals.push_back(normal);
-    track.verts.push_back(start2);
-    track.normals.push_back(normal);
+    math::Vec3f lastNormal = vertices[2 * samples - 1].normal;
+    vertices[2 * samples] = vertices[0];
+    vertices[2 * samples + 1] = vertices[1];
+    vertices[2 * samples].normal = lastNormal;
+    vertices[2 * samples + 1].normal = lastNormal;
 }
 
 /**
  * To generate the support beams needed for the track and angle them out if the track
- * normal is pointed in the negative y direction.
+ * normal is pointed in the negative y direction. Supports add different numbers
+ * of vertices, so one parallel pass counts them, a prefix sum gives each sample
+ * its place in the preallocated arrays and a second parallel pass fills them in.
  */
 void generateSupports(const math::geometry::Curve &curve,
-                      opengl::Geometry &supports,
-                      double deltaTime) {
+                      const TrackFrames &frames,
+                      const vector<PointRange> &loops,
+                      opengl::Geometry &supports) {
 
     const unsigned int granularity = 1000; // how coarse the track is displayed
-    math::Vec3f support;
-    math::Vec3f normal, tangent, binormal, newSupport;
+    const float ground = -0.1f;
 
-    // go through every so many points to create a rought approximation of the track supports
-    for (unsigned int i = 0; i < curve.pointCount(); i += granularity) {
-        normal = getNormal(curve, i, deltaTime);
-        tangent = getTangent(curve, i, deltaTime);
-        binormal = cross(tangent, normal);
-        normal = cross(binormal, tangent);
-
-        bool pos1 = (i >= 22000 && i <= 25500);
-
-        if (normal.m_y < 0.0) {
-            if ( pos1 ) { // if not in the loop
-                continue; // go to the next point and skip this
-
-            } else { // create angled support for areas where the track noraml is facing down
-                support = curve[i];
-                supports.verts.push_back(support);
-                supports.normals.push_back(math::Vec3f(0,0,0));
-
-                newSupport = support + (normalized(-normal) * 0.2);
-                for (unsigned int i = 0; i < 2; i++) { // push back twice for proper gl_lines
-                    supports.verts.push_back(newSupport);
-                    supports.normals.push_back(math::Vec3f(0,0,0));
-                }
+    unsigned int count = curve.pointCount();
+    if (count == 0 || frames.size() != count)
+        return;
 
-                support.m_y = -0.1; // get the ground position directly below
-                supports.verts.push_back(math::Vec3f(newSupport.m_x, -0.1, newSupport.m_z));
-                supports.normals.push_back(math::Vec3f(0,0,0));
+    // go through every so many points to create a rought approximation of the track supports
+    size_t samples = (count - 1) / granularity + 1;
+    vector<size_t> offset(samples + 1, 0);
+    util::ThreadPool &pool = util::defaultThreadPool();
+
+    pool.parallelFor(samples, [&](size_t begin, size_t end) {
+        for (size_t k = begin; k < end; k++)
+            offset[k + 1] = supportVertexCount(frames, loops, k * granularity);
+    }, MESH_GRAIN);
+    for (size_t k = 0; k < samples; k++)
+        offset[k + 1] += offset[k];
+
+    size_t base = supports.vertices.size();
+    supports.vertices.resize(base + offset[samples]); // the normals stay zero
+    opengl::Vertex *vertices = supports.vertices.data() + base;
+
+    pool.parallelFor(samples, [&](size_t begin, size_t end) {
+        for (size_t k = begin; k < end; k++) {
+            unsigned int i = k * granularity;
+            opengl::Vertex *out = vertices + offset[k];
+            math::Vec3f support = curve[i];
+
+            switch (offset[k + 1] - offset[k]) {
+            case 4: { // angled support for areas where the track normal is facing down
+                math::Vec3f newSupport = support + (normalized(-frames[i].normal) * 0.2f);
+                out[0].position = support;
+                out[1].position = newSupport; // twice for proper gl_lines
+                out[2].position = newSupport;
+                out[3].position = math::Vec3f(newSupport.m_x, ground, newSupport.m_z); // ground directly below
+                break;
             }
-
-        } else {
-            if ( !pos1 ) { // if not in the loop
-                support = curve[i];
-                supports.verts.push_back(support);
-                supports.normals.push_back(math::Vec3f(0,0,0));
-                support.m_y = -0.1; // get the ground position directly below
-                supports.verts.push_back(support);
-                supports.normals.push_back(math::Vec3f(0,0,0));
+            case 2:
+                out[0].position = support;
+                out[1].position = math::Vec3f(support.m_x, ground, support.m_z); // ground directly below
+                break;
+            default:
+                break;
             }
         }
-    }
+    }, MESH_GRAIN);
 }
 
 
@@ -327,9 +775,9 @@ void generateSupports(const math::geometry::Curve &curve,
 /**
  * To take a cart position and figure out on the track what the cart orientation should be
  */
-math::Mat4f getOrientation(const math::geometry::Curve &curve, unsigned int pos, double deltaTime) {
-    math::Vec3f normal = getNormal(curve, pos, deltaTime);
-    math::Vec3f tangent = getTangent(curve, pos, deltaTime);
+math::Mat4f getOrientation(const SimulationContext &context, const TrainState &state, unsigned int pos, double deltaTime) {
+    math::Vec3f normal = getNormal(context, state, pos, deltaTime);
+    math::Vec3f tangent = getTangent(context, state, pos, deltaTime);
     math::Vec3f binormal = normalized(cross(tangent, normal));
     normal = cross(binormal, tangent); // make sure normal is indeed orthogonal
 
@@ -341,21 +789,245 @@ math::Mat4f getOrientation(const math::geometry::Curve &curve, unsigned int pos,
     return rotationMatrix;
 }
 
+namespace {
+
+// store the [binormal normal tangent] basis as a row major 3x3 rotation
+void packRotation(TrackFrame &frame) {
+    frame.rotation = {frame.binormal.m_x, frame.normal.m_x, frame.tangent.m_x,
+                      frame.binormal.m_y, frame.normal.m_y, frame.tangent.m_y,
+                      frame.binormal.m_z, frame.normal.m_z, frame.tangent.m_z};
+}
+
+} // namespace
+
+/**
+ * Compute the frame at every point of the curve in a single pass. The speed at
+ * each point is found once (in track order so the braking section starts from
+ * the speed at the end of the fall). The tangent is a central difference of the
+ * neighbouring points and the centripetal acceleration is the speed squared
+ * times the curvature, taken from a second difference over the points passed in
+ * one time step (at least one, so slow sections never difference a point with
+ * itself).
+ */
+TrackFrames computeTrackFrames(const math::geometry::Curve &curve, const PhaseLayout &phases, double deltaTime) {
+    unsigned int count = curve.pointCount();
+    TrackFrames frames(count);
+    if (count < 3)
+        return frames;
+
+    SimulationContext context(curve, phases);
+    TrainState state;
+    auto wrap = [count](long i) { return (unsigned int)(((i % (long)count) + count) % count); };
+
+    for (unsigned int i = 0; i < count; i++) {
+        double speed = v(context, state, i);
+        unsigned int hop = std::max(1u, (unsigned int)(getDistance(speed, deltaTime) / context.deltaS));
+        hop = std::min(hop, (count - 1) / 2);
+
+        math::Vec3f prev = curve[wrap((long)i - hop)];
+        math::Vec3f next = curve[wrap((long)i + hop)];
+        double span = hop * context.deltaS;
+        math::Vec3f curvature = (next - curve[i] * 2.0f + prev) / (float)(span * span);
+        math::Vec3f cAccel = curvature * (float)(speed * speed);
+
+        TrackFrame &frame = frames[i];
+        frame.tangent = normalized(curve[wrap((long)i + 1)] - curve[wrap((long)i - 1)]);
+        frame.normal = normalized(cAccel + math::Vec3f(0.0f, GRAVITY, 0.0f));
+        frame.binormal = normalized(cross(frame.tangent, frame.normal));
+        frame.normal = cross(frame.binormal, frame.tangent); // make sure normal is indeed orthogonal
+        packRotation(frame);
+    }
+
+    return frames;
+}
+
+/**
+ * Compute rotation minimizing frames along the curve with the double reflection
+ * method (Wang et al. 2008) in a single walk over the points. The normal starts
+ * as the world up direction projected off the first tangent and is carried from
+ * point to point with two reflections, so it never flips where the acceleration
+ * vanishes. The twist left over after going once around the closed track is
+ * spread evenly over the points so the frames meet up at the seam. An optional
+ * twist (radians per point) banks the track about its tangent.
+ */
+TrackFrames computeRotationMinimizingFrames(const math::geometry::Curve &curve,
+                                            const vector<float> *twist) {
+    unsigned int count = curve.pointCount();
+    TrackFrames frames(count);
+    if (count < 3)
+        return frames;
+
+    // central difference tangent, the points are evenly spaced by arc length
+    auto tangentAt = [&](unsigned int i) {
+        unsigned int prev = i == 0 ? count - 1 : i - 1;
+        unsigned int next = i + 1 == count ? 0 : i + 1;
+        return normalized(curve[next] - curve[prev]);
+    };
+
+    math::Vec3f up(0.0f, 1.0f, 0.0f);
+    math::Vec3f tangent = tangentAt(0);
+    math::Vec3f normal = up - tangent * (up * tangent);
+    if (normSquared(normal) < 1e-8f) // track starts vertical, any perpendicular works
+        normal = cross(tangent, math::Vec3f(1.0f, 0.0f, 0.0f));
+    normal = normalized(normal);
+
+    frames[0].tangent = tangent;
+    frames[0].normal = normal;
+
+    // transport the normal with two reflections per step, the last step closes
+    // the loop so the seam twist can be measured against the first frame
+    for (unsigned int i = 0; i < count; i++) {
+        unsigned int next = i + 1 == count ? 0 : i + 1;
+        math::Vec3f nextTangent = next == 0 ? frames[0].tangent : tangentAt(next);
+
+        math::Vec3f v1 = curve[next] - curve[i]; // reflect across the bisector plane of the two points
+        float c1 = v1 * v1;
+        math::Vec3f rL = normal;
+        math::Vec3f tL = tangent;
+        if (c1 > 0.0f) {
+            rL = normal - v1 * ((2.0f / c1) * (v1 * normal));
+            tL = tangent - v1 * ((2.0f / c1) * (v1 * tangent));
+        }
+        math::Vec3f v2 = nextTangent - tL; // reflect the tangent onto the next tangent
+        float c2 = v2 * v2;
+        normal = c2 > 0.0f ? rL - v2 * ((2.0f / c2) * (v2 * rL)) : rL;
+        tangent = nextTangent;
+
+        if (next != 0) {
+            frames[next].tangent = tangent;
+            frames[next].normal = normal;
+        }
+    }
+
+    // angle the transported normal ends up from the first normal about the first tangent
+    math::Vec3f first = frames[0].normal;
+    float seamAngle = atan2(cross(normal, first) * frames[0].tangent, normal * first);
+
+    for (unsigned int i = 0; i < count; i++) {
+        TrackFrame &frame = frames[i];
+        float angle = seamAngle * ((float)i / (float)count);
+        if (twist && i < twist->size())
+            angle += (*twist)[i];
+
+        // rotate the normal about the tangent and rebuild an orthonormal basis
+        math::Vec3f side = cross(frame.tangent, frame.normal);
+        frame.normal = normalized(frame.normal * cos(angle) + side * sin(angle));
+        frame.binormal = normalized(cross(frame.tangent, frame.normal));
+        frame.normal = cross(frame.binormal, frame.tangent);
+        packRotation(frame);
+    }
+
+    return frames;
+}
+
+/**
+ * Angle about the tangent that turns each normal of frames onto the normal of
+ * target, averaged over the points within window on either side. Averaging is
+ * done on the unit circle so angles near +-pi and the seam need no unwrapping.
+ * Passing the result as the twist of computeRotationMinimizingFrames() banks the
+ * smooth frames the way target does without its point to point jitter.
+ */
+vector<float> getBankAngles(const TrackFrames &frames, const TrackFrames &target, unsigned int window) {
+    unsigned int count = std::min(frames.size(), target.size());
+    vector<float> angles(count, 0.0f);
+    if (count == 0)
+        return angles;
+
+    // running sums of the unit vector of every angle, doubled to cover the wrap.
+    // A degenerate frame has no angle and is left out so it cannot poison every
+    // window after it
+    vector<double> sumCos(2 * count + 1, 0.0), sumSin(2 * count + 1, 0.0);
+    for (unsigned int k = 0; k < 2 * count; k++) {
+        const TrackFrame &frame = frames[k % count];
+        const math::Vec3f &normal = target[k % count].normal;
+        double angle = atan2(cross(frame.normal, normal) * frame.tangent, frame.normal * normal);
+        bool valid = std::isfinite(angle);
+        sumCos[k + 1] = sumCos[k] + (valid ? cos(angle) : 0.0);
+        sumSin[k + 1] = sumSin[k] + (valid ? sin(angle) : 0.0);
+    }
+
+    // points first..first + 2 * window average into the one at their centre
+    window = std::min(window, (count - 1) / 2);
+    for (unsigned int first = 0; first < count; first++) {
+        unsigned int last = first + 2 * window + 1;
+        angles[(first + window) % count] = atan2(sumSin[last] - sumSin[first], sumCos[last] - sumCos[first]);
+        assert(std::isfinite(angles[(first + window) % count]));
+    }
+
+    return angles;
+}
+
+/**
+ * Get the frame at arc length s, blending the frames of the curve points either
+ * side of it and making the result orthonormal again.
+ */
+TrackFrame getFrameAt(const SimulationContext &context, const TrackFrames &frames, double s) {
+    s = wrapArcLength(context, s);
+    unsigned int i = getIndex(context, s);
+    unsigned int next = (i + 1) % frames.size();
+    float u = (float)(s / context.deltaS - i);
+
+    TrackFrame frame;
+    frame.tangent = normalized(lerp(frames[i].tangent, frames[next].tangent, u));
+    frame.binormal = normalized(cross(frame.tangent, lerp(frames[i].normal, frames[next].normal, u)));
+    frame.normal = cross(frame.binormal, frame.tangent);
+    packRotation(frame);
+    return frame;
+}
+
+/**
+ * Rotation minimizing frames banked like the force based frames, so they never
+ * flip or jitter but still lean into the turns. smoothing is the number of
+ * points either side averaged into the banking.
+ */
+TrackFrames computeBankedFrames(const math::geometry::Curve &curve,
+                                const PhaseLayout &phases,
+                                double deltaTime,
+                                unsigned int smoothing) {
+    vector<float> bank = getBankAngles(computeRotationMinimizingFrames(curve),
+                                       computeTrackFrames(curve, phases, deltaTime),
+                                       smoothing);
+    return computeRotationMinimizingFrames(curve, &bank);
+}
+
+/**
+ * Look up the cart orientation at a curve point in the precomputed frames
+ */
+math::Mat4f getOrientation(const TrackFrames &frames, unsigned int pos) {
+    return getOrientation(frames[pos]);
+}
+
+/**
+ * Expand the packed rotation of a frame into a model matrix
+ */
+math::Mat4f getOrientation(const TrackFrame &frame) {
+    const array<float, 9> &r = frame.rotation;
+
+    Mat4f rotationMatrix = {r[0], r[1], r[2], 0,
+                            r[3], r[4], r[5], 0,
+                            r[6], r[7], r[8], 0,
+                            0.0f, 0.0f, 0.0f, 1.0f};
+
+    return rotationMatrix;
+}
+
 /**
  * Get the surface normal to the current point
  */
-math::Vec3f getNormal(const math::geometry::Curve &curve, unsigned int pos, double deltaTime) {
-    math::Vec3f cAccel = getAcceleration(curve, pos, deltaTime); // do not multiply by velocity squared
-    math::Vec3f normal = normalized(cAccel + math::Vec3f(0.0f, GRAVITY, 0.0f));
+math::Vec3f getNormal(const SimulationContext &context, const TrainState &state, unsigned int pos, double deltaTime) {
+    math::Vec3f cAccel = getAcceleration(context, state, pos, deltaTime); // do not multiply by velocity squared
+    math::Vec3f normal = normalized(cAccel + math::Vec3f(0.0f, context.parameters.gravity, 0.0f));
     return normal;
 }
 
 /**
  * Get the surface tangent to the current point
  */
-math::Vec3f getTangent(const math::geometry::Curve &curve, unsigned int pos, double deltaTime) {
+math::Vec3f getTangent(const SimulationContext &context, const TrainState &state, unsigned int pos, double deltaTime) {
+    const math::geometry::Curve &curve = *context.curve;
+    TrainState probe = state; // looking ahead does not move the train
     math::Vec3f cur = curve[pos];
-    math::Vec3f next = curve[getPosition(curve, pos, v(curve, pos), deltaTime)]; // get the next position based on speed
+    math::Vec3f next = curve[getPosition(context, pos, v(context, probe, pos), deltaTime)]; // get the next position based on speed
     math::Vec3f tangent = normalized(next - cur);
     return tangent;
 }
@@ -363,9 +1035,9 @@ math::Vec3f getTangent(const math::geometry::Curve &curve, unsigned int pos, dou
 /**
  * Get the surface binormal to the current point
  */
-math::Vec3f getBinormal(const math::geometry::Curve &curve, unsigned int pos, double deltaTime) {
-    math::Vec3f normal = getNormal(curve, pos, deltaTime);
-    math::Vec3f tangent = getTangent(curve, pos, deltaTime);
+math::Vec3f getBinormal(const SimulationContext &context, const TrainState &state, unsigned int pos, double deltaTime) {
+    math::Vec3f normal = getNormal(context, state, pos, deltaTime);
+    math::Vec3f tangent = getTangent(context, state, pos, deltaTime);
     math::Vec3f binormal = normalized(math::cross(tangent, normal));
 
     return binormal;
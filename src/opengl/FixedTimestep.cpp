@@ -0,0 +1,48 @@
+/**
+ * Author: Glenn Skelton
+ *
+ * Converts wall clock time into a whole number of fixed length simulation steps
+ * so the physics runs at the same speed no matter how fast frames are drawn.
+ */
+
+#include <algorithm>
+
+#include "FixedTimestep.h"
+
+namespace opengl {
+
+FixedTimestep::FixedTimestep() : FixedTimestep(1.0 / 60.0) {}
+
+FixedTimestep::FixedTimestep(double stepSeconds, unsigned int maxStepsPerFrame)
+    : m_stepSeconds(stepSeconds), m_maxStepsPerFrame(std::max(maxStepsPerFrame, 1u)), m_last(Clock::now()) {}
+
+void FixedTimestep::reset() {
+    m_accumulator = 0.0;
+    m_last = Clock::now();
+}
+
+/**
+ * Add the wall time since the last call and take as many whole steps out of it
+ * as fit. When the program falls too far behind (a breakpoint, dragging the
+ * window) the backlog is dropped instead of fast forwarding the ride.
+ */
+unsigned int FixedTimestep::advance() {
+    Clock::time_point now = Clock::now();
+    m_accumulator += std::chrono::duration<double>(now - m_last).count();
+    m_last = now;
+
+    unsigned int steps = (unsigned int)(m_accumulator / m_stepSeconds);
+    if (steps > m_maxStepsPerFrame) {
+        steps = m_maxStepsPerFrame;
+        m_accumulator = 0.0;
+    } else {
+        m_accumulator -= steps * m_stepSeconds;
+    }
+    return steps;
+}
+
+double FixedTimestep::alpha() const { return std::min(m_accumulator / m_stepSeconds, 1.0); }
+
+double FixedTimestep::stepSeconds() const { return m_stepSeconds; }
+
+} // namespace opengl
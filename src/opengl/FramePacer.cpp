@@ -0,0 +1,89 @@
+/**
+ * Author: Glenn Skelton
+ *
+ * Paces the main loop to a target frame rate by sleeping until the deadline of
+ * the next frame instead of spinning on the clock.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+#include "FramePacer.h"
+
+namespace opengl {
+
+FramePacer::FramePacer() : FramePacer(60.0) {}
+
+FramePacer::FramePacer(double framesPerSecond) {
+    setRate(framesPerSecond);
+    restart();
+}
+
+void FramePacer::setRate(double framesPerSecond) {
+    m_interval = framesPerSecond > 0.0
+        ? std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / framesPerSecond))
+        : Clock::duration::zero();
+}
+
+bool FramePacer::isUncapped() const { return m_interval == Clock::duration::zero(); }
+
+double FramePacer::secondsUntilNextFrame() const {
+    double remaining = std::chrono::duration<double>(m_nextFrame - Clock::now()).count();
+    return std::max(remaining, 0.0);
+}
+
+void FramePacer::waitForNextFrame() {
+    if (!isUncapped())
+        std::this_thread::sleep_until(m_nextFrame);
+}
+
+/**
+ * Record the time since the previous frame and move the deadline on by one
+ * interval. A late frame moves the deadline to now so the loop does not try to
+ * catch up with a burst of frames.
+ */
+void FramePacer::frameFinished() {
+    Clock::time_point now = Clock::now();
+    double frameTime = std::chrono::duration<double, std::milli>(now - m_lastFrame).count();
+    m_lastFrame = now;
+
+    m_frames++;
+    double delta = frameTime - m_mean;
+    m_mean += delta / m_frames;
+    m_m2 += delta * (frameTime - m_mean);
+    m_min = m_frames == 1 ? frameTime : std::min(m_min, frameTime);
+    m_max = m_frames == 1 ? frameTime : std::max(m_max, frameTime);
+
+    m_nextFrame += m_interval;
+    if (m_nextFrame < now)
+        m_nextFrame = now;
+}
+
+void FramePacer::restart() {
+    m_lastFrame = Clock::now();
+    m_nextFrame = m_lastFrame + m_interval;
+}
+
+FramePacer::Statistics FramePacer::statistics() const {
+    Statistics stats;
+    stats.frames = m_frames;
+    stats.mean = m_mean;
+    stats.min = m_min;
+    stats.max = m_max;
+    stats.standardDeviation = m_frames > 1 ? std::sqrt(m_m2 / (m_frames - 1)) : 0.0;
+    return stats;
+}
+
+void FramePacer::resetStatistics() {
+    m_frames = 0;
+    m_mean = m_m2 = m_min = m_max = 0.0;
+}
+
+std::ostream &operator<<(std::ostream &out, FramePacer::Statistics const &stats) {
+    out << stats.frames << " frames, mean " << stats.mean << " ms (" << (stats.mean > 0.0 ? 1000.0 / stats.mean : 0.0)
+        << " fps), min " << stats.min << " ms, max " << stats.max << " ms, std dev " << stats.standardDeviation << " ms";
+    return out;
+}
+
+} // namespace opengl
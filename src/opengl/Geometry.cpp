@@ -14,15 +14,12 @@ namespace opengl {
 Geometry::Geometry() :
     vaoID(0),
     vertexBufferID(0),
-    normalBufferID(0),
-    colourBufferID(0),
-    uvBufferID(0),
     indexBufferID(0),
     verticesCount(0),
     indicesCount(0),
     modelMatrix(math::identity()) {}
 
 Geometry::~Geometry() {
-    verts.clear();
+    vertices.clear();
 }
 } // namespace opengl
@@ -13,7 +13,8 @@
 #include <iostream>
 #include <limits>
 #include <vector>
-#include <ctime>
+#include <chrono>
+#include <algorithm>
 
 // SOUND LIBRARY
 #include <irrKlang.h>
@@ -21,6 +22,7 @@
 #include "glad/glad.h"
 #include <GLFW/glfw3.h>
 
+#include "bsplinecurve.h"
 #include "camera.h"
 #include "curve.h"
 #include "curvefileio.h"
@@ -33,6 +35,8 @@
 #include "GraphicsProgram.h"
 #include "CoasterPhysics.h"
 #include "Model.h"
+#include "taskgraph.h"
+#include "threadpool.h"
 
 
 
@@ -57,65 +61,84 @@ GraphicsProgram::GraphicsProgram(string title) : TITLE(title) {
     prog = this; // initalize global pointer to this instance
     setupWindow();
     renderer = new RenderingEngine();
-
-#if SOUND_ENABLE
-    mediaPlayer = createIrrKlangDevice(); // setup the media player
-    if (!mediaPlayer)
-        exit(EXIT_FAILURE);
-    // load sound sources
-    liftSFX = mediaPlayer->addSoundSourceFromFile("./sounds/lift.wav");
-    roarSFX = mediaPlayer->addSoundSourceFromFile("./sounds/roar.wav");
-    liftAudio = mediaPlayer->play2D(liftSFX, false, true, true); // starts paused and can be tracked
-    roarAudio = mediaPlayer->play2D(roarSFX, true, true, true);
-    mediaPlayer->update();
-    mediaPlayer->setSoundVolume(0.5); // set the overall volume to half the max
-
-    if (!liftAudio && !roarAudio) {
-        cerr << "Sound player failed to initialize" << endl;
-        exit(EXIT_FAILURE);
-    }
-#endif
-
+    // the sounds are loaded with the rest of the assets in init()
 }
 
 GraphicsProgram::~GraphicsProgram() {
     delete renderer;
 
 #if SOUND_ENABLE
-    // clean up media memory
-    mediaPlayer->removeAllSoundSources();
-    liftSFX->drop();
-    roarSFX->drop();
-    mediaPlayer->drop();
+    // clean up media memory, loading may have stopped part way
+    if (mediaPlayer) {
+        mediaPlayer->removeAllSoundSources();
+        if (liftSFX)
+            liftSFX->drop();
+        if (roarSFX)
+            roarSFX->drop();
+        mediaPlayer->drop();
+    }
 #endif
 
 }
 
 /********************************* PROGRAM FUNCTIONS ********************************/
 /**
- * Main program loop that runs every frame to generate the animations
+ * Main program loop that runs every frame to generate the animations. The
+ * physics, audio and user camera run on their own thread and hand their
+ * latest state over through a triple buffer, so drawing never waits for them.
  */
 void GraphicsProgram::start() {
 
     if (init()) { // Initialize all the geometry, and load it once to the GPU
-        clock_t current = std::clock(), now; // frame rate timer
+        // the frame pacer sleeps between frames, the physics keeps its own fixed step clock
+        g_pacer = FramePacer(g_benchmark ? 0.0 : g_renderRate);
+        g_timestep = FixedTimestep(1.0 / g_simulationRate);
+        if (g_benchmark)
+            glfwSwapInterval(0); // do not wait for vsync either
+
+        publishState(); // something to draw before the first tick
+        g_snapshots.update();
+        g_simulating = true;
+        g_simulationThread = std::thread(&GraphicsProgram::simulationLoop, this);
 
         while (glfwGetKey(window, GLFW_KEY_ESCAPE) != GLFW_PRESS && !glfwWindowShouldClose(window)) {
-            now = std::clock();
+            // when nothing moves on its own sleep until there is input to react to,
+            // the simulation thread posts an event once it has applied the input
+            g_snapshots.update();
+            const SimulationSnapshot &state = g_snapshots.front();
+            bool idle = !state.play && !state.cameraMoving && !g_benchmark;
+
+            if (idle) {
+                glfwWaitEventsTimeout(g_idleTimeout);
+            } else {
+                g_pacer.waitForNextFrame();
+                glfwPollEvents();
+            }
 
-            if ((now - current) / (double)CLOCKS_PER_SEC >= 1.0/60.0) {
-                current = now; // update time
+            // draw the train part way between the last two physics states
+            g_snapshots.update();
+            const SimulationSnapshot &latest = g_snapshots.front();
+            double now = chrono::duration<double>(FixedTimestep::Clock::now().time_since_epoch()).count();
+            double alpha = std::min(std::max((now - latest.stepTime) / latest.stepSeconds, 0.0), 1.0);
+            g_displayS = interpolateArcLength(g_simulation, latest.previousS, latest.s, alpha);
 
-                if (g_play)
-                    oncePerFrame(); // only perform if the program isn't paused
+            animate(g_displayS);
+            moveCamera(); // update the camera matrix
+            displayFunc(); // send result to GPU to display
 
-                displayFunc(); // send result to GPU to display
-                moveCamera(); // update the camera matrix
+            glfwSwapBuffers(window);
 
-                glfwSwapBuffers(window);
-                glfwPollEvents();
-            }
+            if (idle)
+                g_pacer.restart(); // time spent waiting for input is not a frame time
+            else
+                g_pacer.frameFinished();
         }
+
+        g_simulating = false;
+        wakeSimulation();
+        g_simulationThread.join();
+
+        cout << "frame times: " << g_pacer.statistics() << endl;
     }
     cleanup(); // clean up memory
     return;
@@ -202,30 +225,177 @@ bool GraphicsProgram::init() {
     glPointSize(50);
     glEnable(GL_LINE_SMOOTH);
 
-    // SETUP SHADERS, BUFFERS, VAOs
-    if (!loadInTrack())
-        return false;
-
-    // get the scene elements loaded in with their properties
-    loadInGeometry();
-
-    // set up the buffers for the GPU
-    if (!renderer->reloadShadersFromFile(g_program))
-        return false;
-    setupScene(sceneGraph);
-
-    // load cart and track triangles into GPU
-    if (!loadMeshGeometryToGPU()) return false;
-    if (!loadCurveGeometryToGPU()) return false;
-
     resetCamera(g_camera); // get the camera ready
 
     // set the starting position for the camera
     CAM_DEFAULT = glLookAtCamera(CAM_POS, math::Vec3f(), math::Vec3f(0.0, 1.0, 0.0));
     g_camera = CAM_DEFAULT;
+    g_userCamera = CAM_DEFAULT;
     reloadProjectionMatrix();
     reloadViewMatrix();
 
+    // get the scene elements ready with their properties, the data follows
+    loadInGeometry();
+
+    // READ FILES AND BUILD THE TRACK, independent steps run side by side on the
+    // thread pool and only the GPU work is left for this thread
+    auto track = g_startup.add("track", [this]() { return loadInTrack(); });
+    auto frames = g_startup.add("frames", [this]() { return loadTrackFrames(); }, {track});
+    auto simulation = g_startup.add("simulation", [this]() { return loadSimulation(); }, {track});
+    auto trackMesh = g_startup.add("track mesh", [this]() {
+        generateTrack(g_curve, g_trackFrames, g_trackData);
+        return true;
+    }, {frames});
+    auto supportsMesh = g_startup.add("supports mesh", [this]() {
+        generateSupports(g_curve, g_trackFrames, g_trackLoops, g_supportsData);
+        return true;
+    }, {frames});
+    auto carModel = g_startup.add("car model", [this]() {
+        scene::Model::modelParser(g_car1Data, "./models/coasterCar.obj");
+        return true;
+    });
+    auto cars = g_startup.add("cars", [this]() {
+        g_car2Data = g_car1Data;
+        g_car3Data = g_car1Data;
+        updateTrain(g_displayS); // place them at the lift
+        return true;
+    }, {carModel, frames, simulation});
+    auto floor = g_startup.add("floor model", [this]() {
+        scene::Model::modelParser(g_floorData, "./models/floor.obj");
+        return true;
+    });
+    auto gate = g_startup.add("gate model", [this]() {
+        scene::Model::modelParser(g_gateData, "./models/gate.obj");
+        return true;
+    });
+    auto shaders = g_startup.add("shaders", [this]() { return renderer->loadShaderSources(g_shaderSources); });
+    g_startup.add("sounds", [this]() { return loadSounds(); });
+
+    // GPU work for each piece, done on this thread once its task has finished
+    g_uploads = {
+        {shaders, [this]() { return renderer->buildShaders(g_shaderSources, g_program); }},
+        {track, [this]() { return loadCurveGeometryToGPU(); }},
+        {trackMesh, [this]() { return loadMeshGeometryToGPU(g_trackData); }},
+        {supportsMesh, [this]() { return loadMeshGeometryToGPU(g_supportsData); }},
+        {floor, [this]() { return loadMeshGeometryToGPU(g_floorData); }},
+        {gate, [this]() { return loadMeshGeometryToGPU(g_gateData); }},
+        {cars, [this]() {
+            return loadMeshGeometryToGPU(g_car1Data) && loadMeshGeometryToGPU(g_car2Data) &&
+                   loadMeshGeometryToGPU(g_car3Data);
+        }},
+    };
+
+    return loadScene();
+}
+
+/**
+ * Run the startup tasks on a loader thread while this thread keeps the window
+ * responsive. Each piece of the scene is uploaded as soon as it is ready and
+ * whatever has arrived is drawn under a progress bar until everything is in.
+ */
+bool GraphicsProgram::loadScene() {
+    auto loadStart = chrono::steady_clock::now();
+    atomic<bool> loading(true);
+    bool loaded = false;
+    thread loader([this, &loading, &loaded]() {
+        loaded = g_startup.run(util::defaultThreadPool());
+        loading = false;
+        glfwPostEmptyEvent(); // wake the loop below for the last uploads
+    });
+
+    bool uploaded = true, closed = false;
+    for (bool finishing = false; !finishing;) {
+        finishing = !loading; // every task has finished, so this is the last pass
+
+        glfwWaitEventsTimeout(1.0 / 60.0);
+        closed = closed || glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS || glfwWindowShouldClose(window);
+        if (closed)
+            continue; // the loader cannot be interrupted, wait for it to finish
+
+        uploaded = uploadFinishedAssets() && uploaded;
+        drawLoadingScreen();
+        glfwSwapBuffers(window);
+    }
+    loader.join();
+
+    for (size_t i = 0; i < g_startup.size(); i++) {
+        if (!g_startup.succeeded(i))
+            cerr << "startup step " << g_startup.name(i) << " failed or was skipped" << endl;
+    }
+    double loadSeconds = chrono::duration<double>(chrono::steady_clock::now() - loadStart).count();
+    cout << "startup: " << loadSeconds * 1000.0 << " ms, steps "
+         << g_startup.totalSeconds() * 1000.0 << " ms, longest chain "
+         << g_startup.longestChainSeconds() * 1000.0 << " ms" << endl;
+
+    return loaded && uploaded && !closed;
+}
+
+/**
+ * Do the GPU work of every startup task that has finished since the last call
+ */
+bool GraphicsProgram::uploadFinishedAssets() {
+    bool uploaded = true;
+    for (auto it = g_uploads.begin(); it != g_uploads.end();) {
+        if (!g_startup.finished(it->first)) {
+            ++it;
+            continue;
+        }
+        if (g_startup.succeeded(it->first) && !it->second())
+            uploaded = false;
+        it = g_uploads.erase(it);
+    }
+    return uploaded;
+}
+
+/**
+ * Draw the part of the scene that is loaded so far with a progress bar over it.
+ * The bar is cleared through scissor boxes so it needs no shader or geometry.
+ */
+void GraphicsProgram::drawLoadingScreen() {
+    if (g_program.empty()) {
+        glClearColor(BACKGROUND.m_x, BACKGROUND.m_y, BACKGROUND.m_z, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    } else {
+        displayFunc();
+    }
+
+    float progress = g_startup.size() > 0 ? (float)g_startup.finishedCount() / g_startup.size() : 1.f;
+    int width = FB_WIDTH * 3 / 5, height = std::max(FB_HEIGHT / 40, 4);
+    int x = (FB_WIDTH - width) / 2, y = FB_HEIGHT / 10;
+
+    glEnable(GL_SCISSOR_TEST);
+    glScissor(x, y, width, height);
+    glClearColor(0.2f, 0.2f, 0.2f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    glScissor(x, y, (int)(width * progress), height);
+    glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    glDisable(GL_SCISSOR_TEST);
+}
+
+/**
+ * Open the sound device and load the sound effects, the sounds start paused
+ */
+bool GraphicsProgram::loadSounds() {
+#if SOUND_ENABLE
+    mediaPlayer = createIrrKlangDevice(); // setup the media player
+    if (!mediaPlayer) {
+        cerr << "Sound player failed to initialize" << endl;
+        return false;
+    }
+    // load sound sources
+    liftSFX = mediaPlayer->addSoundSourceFromFile("./sounds/lift.wav");
+    roarSFX = mediaPlayer->addSoundSourceFromFile("./sounds/roar.wav");
+    liftAudio = mediaPlayer->play2D(liftSFX, false, true, true); // starts paused and can be tracked
+    roarAudio = mediaPlayer->play2D(roarSFX, true, true, true);
+    mediaPlayer->update();
+    mediaPlayer->setSoundVolume(0.5); // set the overall volume to half the max
+
+    if (!liftAudio && !roarAudio) {
+        cerr << "Sound player failed to initialize" << endl;
+        return false;
+    }
+#endif
     return true;
 }
 
@@ -235,56 +405,52 @@ bool GraphicsProgram::init() {
  * borrowed from Andrew Owens boilerplate code.
  */
 bool GraphicsProgram::loadInTrack() {
-    using namespace math::geometry;
-
     // get the track info and load it in to memory
-    if (g_curveFilePath.empty()) {
+    if (g_curveFilePath.empty())
         return false;
-    } else {
-        // auto curve = loadCurveFromFile(g_curveFilePath); // load from .txt file
-        auto curve = loadCurveFrom_OBJ_File(g_curveFilePath); // load from .obj file
-        if (curve.pointCount() == 0) {
-            cerr << "curve is empty" << endl;
-            return false;
-        }
-        g_curve = Curve(move(curve)); // load curve data into global curve variable
-    }
 
-    // reparameterize the curve
-    g_curve = math::geometry::cubicSubdivideCurve(g_curve, g_numberOfSubdivisions);
-    g_curve = ttlArcLengthReParam(g_curve, (unsigned int)(length(g_curve) * 1000));
-    curveVertexID = LIFT_START; // set the starting position for the roller coaster simulation
+    Track track;
+    if (!loadTrack(g_curveFilePath, g_curveCachePath, g_samplesPerUnit, track))
+        return false;
+    g_curve = move(track.curve); // load curve data into global curve variable
+    g_spline = move(track.spline);
+    g_curveParameters = move(track.parameters);
+    g_trackPhases = move(track.phases);
+    g_trackLoops = move(track.loops);
 
 #if DEBUG
-    cout << "start: " << LIFT_START << ", decel: " << DECEL_START << endl;
+    cout << "start: " << getPhaseStart(g_trackPhases, LIFT) << ", decel: " << getPhaseStart(g_trackPhases, END) << endl;
 #endif
     return true;
 }
 
+/**
+ * orientation is looked up from here every frame, the frames are rotation
+ * minimizing so they never flip and are banked like the force based frames
+ */
+bool GraphicsProgram::loadTrackFrames() {
+    g_trackFrames = computeBankedFrames(g_curve, g_trackPhases, TIME, g_bankSmoothing);
+    return g_trackFrames.size() == g_curve.pointCount();
+}
+
+/**
+ * track extrema and phases used by every step, and the train at the lift
+ */
+bool GraphicsProgram::loadSimulation() {
+    g_simulation = SimulationContext(g_curve, g_trackPhases);
+    g_train = TrainState(g_simulation); // start the roller coaster simulation at the lift
+    g_previousTrain = g_train;
+    g_displayS = g_train.s;
+    return true;
+}
+
 
 /**
- * retrieve all of the models and set their parameters and store them
- * into the scene graph.
+ * set the parameters of all the models, they join the scene graph once their
+ * data has been loaded and sent to the GPU.
  */
 void GraphicsProgram::loadInGeometry() {
-    // store all the scene data structures in an array
-    sceneGraph.push_back(&g_trackData);
-    sceneGraph.push_back(&g_supportsData);
-    sceneGraph.push_back(&g_floorData);
-    sceneGraph.push_back(&g_gateData);
-    sceneGraph.push_back(&g_car1Data);
-    sceneGraph.push_back(&g_car2Data);
-    sceneGraph.push_back(&g_car3Data);
-
-    // read in models
-    scene::Model::modelParser(g_car1Data, "./models/coasterCar.obj");
-    g_car2Data = g_car1Data;
-    g_car3Data = g_car1Data;
-    scene::Model::modelParser(g_floorData, "./models/floor.obj");
-    scene::Model::modelParser(g_gateData, "./models/gate.obj");
     g_gateData.modelMatrix = openGL::TranslateMatrix(math::Vec3f(4, 0, 2.5)) * openGL::UniformScaleMatrix(0.2f);
-    generateTrack(g_curve, g_trackData, TIME);
-    generateSupports(g_curve, g_supportsData, TIME);
 
     // set the draw modes
     g_trackData.drawMode = GL_TRIANGLE_STRIP;
@@ -315,8 +481,6 @@ void GraphicsProgram::loadInGeometry() {
     g_car1Data.colour = cartColour;
     g_car2Data.colour = cartColour;
     g_car3Data.colour = cartColour;
-
-    updateTrain(curveVertexID);
 }
 
 
@@ -359,43 +523,24 @@ void GraphicsProgram::deleteScene(vector<Geometry*> graph) {
 /******************************* BIND BUFFER DATA TO GPU *************************************/
 
 /**
- * To go through all of the scenes geometry and bind their buffer ID's
- * to the GPU.
+ * To bind the buffer ID's of a piece of geometry, send its data to the GPU and
+ * add it to the scene graph.
  *
  * Borrowed from boilerplate code from Andrew Owens in CPSC 587.
  */
-bool GraphicsProgram::loadMeshGeometryToGPU() {
+bool GraphicsProgram::loadMeshGeometryToGPU(Geometry &geometry) {
+    Geometry *g = &geometry;
+    setupScene({g});
 
-    // load in all of the geometry for meshes
-    for (Geometry *g : sceneGraph) {
-
-        // load all the colours into the roller coaster parts
-        for (unsigned int i = 0; i < g->verts.size(); i++) {
-            g->colours.push_back(g->colour);
-        }
-
-        // load vertices
-        glBindBuffer(GL_ARRAY_BUFFER, g->vertexBufferID);
-        glBufferData(GL_ARRAY_BUFFER,
-                     sizeof(math::Vec3f) * g->verts.size(), // byte size of Vec3f
-                     g->verts.data(),    // pointer (Vec3f*) to contents of verts
-                     GL_STATIC_DRAW); // Usage pattern of GPU buffer
-
-        // load normals
-        glBindBuffer(GL_ARRAY_BUFFER, g->normalBufferID);
-        glBufferData(GL_ARRAY_BUFFER,
-                     sizeof(math::Vec3f) * g->normals.size(), // byte size of Vec3f
-                     g->normals.data(),    // pointer (Vec3f*) to contents of verts
-                     GL_STATIC_DRAW); // Usage pattern of GPU buffer
-
-        // load colours
-        glBindBuffer(GL_ARRAY_BUFFER, g->colourBufferID);
-        glBufferData(GL_ARRAY_BUFFER,
-                     sizeof(math::Vec3f) * g->colours.size(), // byte size of Vec3f
-                     g->colours.data(),    // pointer (Vec3f*) to contents of verts
-                     GL_STATIC_DRAW); // Usage pattern of GPU buffer
+    // load all the colours into the roller coaster parts
+    for (Vertex &vertex : g->vertices) {
+        vertex.colour = g->colour;
     }
 
+    // positions, normals and colours go up together
+    renderer->uploadVertices(*g);
+
+    sceneGraph.push_back(g); // drawn from now on
     return true;
 }
 
@@ -447,7 +592,7 @@ void GraphicsProgram::displayFunc() {
         program.setUniform1i("shade", 1);
 
         glBindVertexArray(g->vaoID);
-        glDrawArrays(g->drawMode, 0, g->verts.size());
+        glDrawArrays(g->drawMode, 0, g->vertices.size());
     }
 
     program.setUniformVec3f("lightPosition_worldSpace", LIGHT_SOURCE); // light
@@ -465,29 +610,119 @@ void GraphicsProgram::displayFunc() {
 /************************************ CONTROL ANIMATION ***********************************/
 
 /**
- * Move along the curve incrementing based on velocity of point. Also update
- * the audio if need be.
+ * Body of the simulation thread. Every tick it applies the input sent by the
+ * callbacks, runs the physics steps that are due, updates the audio and the
+ * user camera and publishes the result for the render thread. It then sleeps
+ * until the next step is due.
  */
-void GraphicsProgram::oncePerFrame() {
-    // update for next frame
-    unsigned int tolerance = 2;
-    if ( (curveVertexID >= LIFT_START - tolerance) && (curveVertexID <= LIFT_START) ) // check the end tolerance
-        curveVertexID = LIFT_START; // ensure that the train always starts at exactly the LIFT_START
+void GraphicsProgram::simulationLoop() {
+    while (g_simulating) {
+        SimulationCommand command;
+        bool input = false;
+        while (g_commands.pop(command)) {
+            applyCommand(command);
+            input = true;
+        }
 
-    double speed = v(g_curve, curveVertexID);
-    curveVertexID = getPosition(g_curve, curveVertexID, speed, TIME);
-    curveVertexID = curveVertexID % g_curve.pointCount(); // wrap around
+        // the clock keeps running while paused so the camera moves at the same rate
+        unsigned int steps = g_timestep.advance();
+        if (g_play) {
+            simulationStep(steps);
+            updateAudio();
+        }
+        if (CAMERA_ANGLE == DISTANT)
+            moveUserCamera(steps);
 
 #if DEBUG
-    cout << "CURVE ID: " << curveVertexID << endl;
+        cout << "CURVE ID: " << g_train.index << endl;
 #endif
 
+        publishState();
+        if (input)
+            glfwPostEmptyEvent(); // wake the render thread if it is waiting for input
+
+        // when nothing moves there is nothing to step, sleep until a command arrives
+        // and start the clock over so the time spent waiting is not caught up
+        if (!g_play && !g_cameraUpdate.needsUpdating()) {
+            std::unique_lock<std::mutex> lock(g_commandMutex);
+            g_commandReady.wait(lock, [this]() { return !g_commands.empty() || !g_simulating; });
+            g_timestep.reset();
+            continue;
+        }
+
+        double wait = (1.0 - g_timestep.alpha()) * g_timestep.stepSeconds();
+        std::this_thread::sleep_for(chrono::duration<double>(wait));
+    }
+}
+
+/**
+ * Wake the simulation thread if it is sleeping while idle
+ */
+void GraphicsProgram::wakeSimulation() {
+    { std::lock_guard<std::mutex> lock(g_commandMutex); } // orders this with the idle check before it sleeps
+    g_commandReady.notify_one();
+}
+
+/**
+ * Apply one input from the callbacks on the simulation thread
+ */
+void GraphicsProgram::applyCommand(const SimulationCommand &command) {
+    using namespace openGL::scene;
+
+    switch (command.type) {
+    case SimulationCommand::TOGGLE_PLAY:
+        g_play = !g_play;
 #if SOUND_ENABLE
-    // update audio
-    unsigned int max = getMaxIndex(g_curve);
+        if (!g_play && mediaPlayer) { // no player until the sounds have loaded
+            // turn of the music playing
+            mediaPlayer->setAllSoundsPaused(true);
+            liftAudioPlaying = false;
+            roarAudioPlaying = false;
+        } // sound will resume on it's own in updateAudio()
+#endif
+        break;
+    case SimulationCommand::PLAY:
+        g_play = true;
+        break;
+    case SimulationCommand::STEP: // advance a single physics step
+        simulationStep(1);
+        break;
+    case SimulationCommand::CAMERA_MOVE:
+        g_cameraUpdate.set((CameraUpdate::Flag)command.value, command.set);
+        break;
+    case SimulationCommand::CAMERA_ANGLE:
+        CAMERA_ANGLE = (ANGLE)command.value;
+        if (CAMERA_ANGLE == DISTANT)
+            g_userCamera = CAM_DEFAULT; // reset to default
+        break;
+    case SimulationCommand::CAMERA_ORBIT:
+        if (CAMERA_ANGLE == DISTANT) {
+            g_userCamera.rotateRightAroundFocus(command.x);
+            g_userCamera.rotateDownAroundFocus(command.y);
+        }
+        break;
+    case SimulationCommand::PANNING_SPEED:
+        g_panningSpeed *= command.x;
+        break;
+    case SimulationCommand::ROTATION_SPEED:
+        g_rotationSpeed *= command.x;
+        break;
+    }
+}
 
-    if (curveVertexID >= LIFT_START || curveVertexID < max + 500) {
-        // if this is called g_play must be true
+/**
+ * Update the audio for where the train is, only called while playing
+ */
+void GraphicsProgram::updateAudio() {
+#if SOUND_ENABLE
+    // update audio, the lift fades out just over the top and the roar fades out
+    // at the start of the brakes
+    const double liftFade = 0.5, roarFade = 2.0; // arc lengths
+    double pastTop = wrapArcLength(g_simulation, g_train.s - g_simulation.maxIndex * g_simulation.deltaS);
+    double intoPhase = distanceIntoPhase(g_simulation, g_train.s);
+    PHASE phase = getPhase(g_simulation, g_train.index);
+
+    if (phase == LIFT || pastTop < liftFade) {
         if (!liftAudioPlaying) {
             liftAudio->setVolume(0.4);
             liftAudioPlaying = true;
@@ -495,11 +730,11 @@ void GraphicsProgram::oncePerFrame() {
             roarAudioPlaying = false;
             roarAudio->setIsPaused(true);
         }
-        if ( (curveVertexID >= max) && (curveVertexID < max + 500) ) {
-            double volume = 1 - ((double)(curveVertexID - (max)) / (double)500);
+        if (pastTop < liftFade) {
+            double volume = 1 - pastTop / liftFade;
             liftAudio->setVolume(liftAudio->getVolume() * volume);
         }
-    } else if (curveVertexID >= max && curveVertexID < DECEL_START + 2000) {
+    } else if (phase == FALL || (phase == END && intoPhase < roarFade)) {
         if (liftAudioPlaying) { // turn off lift effects
             liftAudioPlaying = false;
             liftAudio->setIsPaused(true); // at the top of the lift
@@ -511,8 +746,8 @@ void GraphicsProgram::oncePerFrame() {
                 roarAudio->setIsLooped(false);
             }
         }
-        if ( (curveVertexID >= DECEL_START) && (curveVertexID <= DECEL_START + 2000) ) {
-            double volume = 1 - ((double)(curveVertexID - (DECEL_START)) / (double)2000);
+        if (phase == END) {
+            double volume = 1 - intoPhase / roarFade;
             roarAudio->setVolume(roarAudio->getVolume() * volume);
         }
     } else { // at the end so pause the sound
@@ -524,17 +759,107 @@ void GraphicsProgram::oncePerFrame() {
         roarAudio->setPlayPosition(0);
     }
 #endif
+}
 
-    animate(curveVertexID);
+/**
+ * Advance the physics by t fixed steps, keeping the state before the last one
+ * so the drawn train can be interpolated. Simulation thread only.
+ */
+void GraphicsProgram::simulationStep(int t) {
+    for (int i = 0; i < t; i++) {
+        g_previousTrain = g_train;
+        stepTrain(g_simulation, g_train, g_timestep.stepSeconds());
+    }
 }
 
 /**
- * Retrieve the coordinates of the vertexID and update the objects modelMatrix
+ * Move the user camera by the keys held down for t steps, the speeds are per
+ * frame at g_cameraFrameRate. Simulation thread only.
+ */
+void GraphicsProgram::moveUserCamera(int t) {
+    using namespace openGL::scene;
+
+    if (!g_cameraUpdate.needsUpdating() || t == 0)
+        return;
+
+    float frames = (float)(t * g_timestep.stepSeconds() * g_cameraFrameRate);
+    float panning = g_panningSpeed * frames;
+    float rotation = g_rotationSpeed * frames;
+
+    if (g_cameraUpdate.isSet(CameraUpdate::moveBackward)) {
+        g_userCamera.moveBackward(panning);
+    }
+    if (g_cameraUpdate.isSet(CameraUpdate::moveForward)) {
+        g_userCamera.moveForward(panning);
+    }
+    if (g_cameraUpdate.isSet(CameraUpdate::moveUp)) {
+        g_userCamera.moveUp(panning);
+    }
+    if (g_cameraUpdate.isSet(CameraUpdate::moveDown)) {
+        g_userCamera.moveDown(panning);
+    }
+    if (g_cameraUpdate.isSet(CameraUpdate::moveLeft)) {
+        g_userCamera.moveLeft(panning);
+    }
+    if (g_cameraUpdate.isSet(CameraUpdate::moveRight)) {
+        g_userCamera.moveRight(panning);
+    }
+    if (g_cameraUpdate.isSet(CameraUpdate::rotateLeft)) {
+        g_userCamera.rotateLeft(rotation);
+    }
+    if (g_cameraUpdate.isSet(CameraUpdate::rotateRight)) {
+        g_userCamera.rotateRight(rotation);
+    }
+    if (g_cameraUpdate.isSet(CameraUpdate::rotateUp)) {
+        g_userCamera.rotateUp(rotation);
+    }
+    if (g_cameraUpdate.isSet(CameraUpdate::rotateDown)) {
+        g_userCamera.rotateDown(rotation);
+    }
+    if (g_cameraUpdate.isSet(CameraUpdate::rollLeft)) {
+        g_userCamera.rollLeft(rotation);
+    }
+    if (g_cameraUpdate.isSet(CameraUpdate::rollRight)) {
+        g_userCamera.rollRight(rotation);
+    }
+    // g_cameraUpdate.reset(); // reseting seems jittery, so don't
+}
+
+/**
+ * Hand the current train and camera state to the render thread. While paused
+ * the train is drawn exactly where it stopped.
+ */
+void GraphicsProgram::publishState() {
+    SimulationSnapshot &state = g_snapshots.back();
+    double now = chrono::duration<double>(FixedTimestep::Clock::now().time_since_epoch()).count();
+
+    state.previousS = g_play ? g_previousTrain.s : g_train.s;
+    state.s = g_train.s;
+    state.stepSeconds = g_timestep.stepSeconds();
+    state.stepTime = now - g_timestep.alpha() * state.stepSeconds;
+    state.play = g_play;
+    state.cameraMoving = g_cameraUpdate.needsUpdating();
+    state.angle = CAMERA_ANGLE;
+    state.camera = g_userCamera;
+    g_snapshots.publish();
+}
+
+/**
+ * Queue input for the simulation thread, called from the GLFW callbacks
+ */
+void GraphicsProgram::sendCommand(const SimulationCommand &command) {
+    if (!g_commands.push(command))
+        cerr << "input dropped, the simulation is not keeping up" << endl;
+    wakeSimulation();
+}
+
+/**
+ * Retrieve the coordinates at arc length s and update the objects modelMatrix
  * translation and scaling. Mostly a wrapper function now and in place for if other
  * objects were to be added.
  */
-void GraphicsProgram::animate(int vertexID) {
-    updateTrain(vertexID);
+void GraphicsProgram::animate(double s) {
+    updateTrain(s);
 }
 
 
@@ -542,27 +867,26 @@ void GraphicsProgram::animate(int vertexID) {
  * update the position of each car based on the middle car which
  * is the center of gravity for this train.
  */
-void GraphicsProgram::updateTrain(unsigned int vertexID) {
+void GraphicsProgram::updateTrain(double s) {
     using namespace openGL;
 
-    // get the carts orientation and add it to the model
-    int newID;
-    math::Vec3f pos = g_curve[vertexID]; // retrieve the position in the curve matrix
-    math::Mat4f RotationMatrix = getOrientation(g_curve, vertexID, TIME);
+    // get the carts orientation and add it to the model, positions and frames
+    // are interpolated between curve points
+    double newS;
+    math::Vec3f pos = getPointAt(g_simulation, s); // retrieve the position along the curve
+    math::Mat4f RotationMatrix = getOrientation(getFrameAt(g_simulation, g_trackFrames, s));
     g_car1Data.modelMatrix = TranslateMatrix(pos) * RotationMatrix * UniformScaleMatrix(0.1f);
 
     // car 3 (front car)
-    newID = (vertexID + carDistance) % g_curve.pointCount();
-    pos = g_curve[newID];
-    RotationMatrix = getOrientation(g_curve, newID, TIME);
+    newS = s + carDistance; // wrapped by the lookups
+    pos = getPointAt(g_simulation, newS);
+    RotationMatrix = getOrientation(getFrameAt(g_simulation, g_trackFrames, newS));
     g_car2Data.modelMatrix = openGL::TranslateMatrix(pos) * RotationMatrix * UniformScaleMatrix(0.1f);
 
     // car 4 (back car)
-    newID = (vertexID - carDistance);
-    if (newID < 0)
-        newID = g_curve.pointCount() + newID; // loop to the back
-    pos = g_curve[newID];
-    RotationMatrix = getOrientation(g_curve, newID, TIME);
+    newS = s - carDistance; // loops to the back
+    pos = getPointAt(g_simulation, newS);
+    RotationMatrix = getOrientation(getFrameAt(g_simulation, g_trackFrames, newS));
     g_car3Data.modelMatrix = openGL::TranslateMatrix(pos) * RotationMatrix * UniformScaleMatrix(0.1f);
 
 }
@@ -596,105 +920,64 @@ void GraphicsProgram::reloadProjectionMatrix() {
 void GraphicsProgram::reloadViewMatrix() { g_V = openGL::scene::makeViewMatrix(g_camera); }
 
 /**
- * Updates camera if update bits are set or if the camera is in CAR or
- * TRACKING mode
+ * Sets the camera the scene is drawn from, following the drawn train in CAR
+ * or TRACKING mode or taking the user camera from the simulation thread
  *
  * This code was borrowed from Andrew Owens from the boilerplate
  * code provided in CPSC 587 and modified by Glenn Skelton.
  */
 void GraphicsProgram::moveCamera() {
     using namespace openGL::scene;
-    math::Vec3f normal, tangent, binormal;
+    TrackFrame frame;
 
     // change the camera type according to
-    switch (CAMERA_ANGLE) {
+    switch (g_snapshots.front().angle) {
     case CAR:
         // update the camera
-        tangent = getTangent(g_curve, curveVertexID, TIME);
-        normal = getNormal(g_curve, curveVertexID, TIME);
-        binormal = normalized(cross(tangent, normal));
-        normal = normalized(cross(binormal, tangent));
-
-        g_camera = openGL::scene::Camera(g_curve[curveVertexID] + normal*0.2, // position
-                                         tangent, // forward
-                                         normal); // up
+        frame = getFrameAt(g_simulation, g_trackFrames, g_displayS);
+
+        g_camera = openGL::scene::Camera(getPointAt(g_simulation, g_displayS) + frame.normal*0.2, // position
+                                         frame.tangent, // forward
+                                         frame.normal); // up
         reloadViewMatrix();
         break;
 
-    case DISTANT: // allow regular user interactions for moving the camera
-        if (g_cameraUpdate.needsUpdating()) {
-            if (g_cameraUpdate.isSet(CameraUpdate::moveBackward)) {
-                g_camera.moveBackward(g_panningSpeed);
-            }
-            if (g_cameraUpdate.isSet(CameraUpdate::moveForward)) {
-                g_camera.moveForward(g_panningSpeed);
-            }
-            if (g_cameraUpdate.isSet(CameraUpdate::moveUp)) {
-                g_camera.moveUp(g_panningSpeed);
-            }
-            if (g_cameraUpdate.isSet(CameraUpdate::moveDown)) {
-                g_camera.moveDown(g_panningSpeed);
-            }
-            if (g_cameraUpdate.isSet(CameraUpdate::moveLeft)) {
-                g_camera.moveLeft(g_panningSpeed);
-            }
-            if (g_cameraUpdate.isSet(CameraUpdate::moveRight)) {
-                g_camera.moveRight(g_panningSpeed);
-            }
-            if (g_cameraUpdate.isSet(CameraUpdate::rotateLeft)) {
-                g_camera.rotateLeft(g_rotationSpeed);
-            }
-            if (g_cameraUpdate.isSet(CameraUpdate::rotateRight)) {
-                g_camera.rotateRight(g_rotationSpeed);
-            }
-            if (g_cameraUpdate.isSet(CameraUpdate::rotateUp)) {
-                g_camera.rotateUp(g_rotationSpeed);
-            }
-            if (g_cameraUpdate.isSet(CameraUpdate::rotateDown)) {
-                g_camera.rotateDown(g_rotationSpeed);
-            }
-            if (g_cameraUpdate.isSet(CameraUpdate::rollLeft)) {
-                g_camera.rollLeft(g_rotationSpeed);
-            }
-            if (g_cameraUpdate.isSet(CameraUpdate::rollRight)) {
-                g_camera.rollRight(g_rotationSpeed);
-            }
-
-            reloadViewMatrix();
-            // g_cameraUpdate.reset(); // reseting seems jittery, so don't
-        }
+    case DISTANT: // the user moves this camera on the simulation thread
+        g_camera = g_snapshots.front().camera;
+        reloadViewMatrix();
         break;
 
     case TRACKING:
-        // define points along the track to set the camera to follow the cart
-        unsigned int cam1 = 172000,
-                     cam2 = getMaxIndex(g_curve)-500,
-                     cam3 = 16000,
-                     cam4 = 34523,
-                     cam5 = 84000,
-                     cam6 = 145000;
+        // define points along the track (arc lengths) to set the camera to follow the cart
+        double cam1 = 172.7817,
+               cam2 = g_simulation.maxIndex * g_simulation.deltaS - 0.5,
+               cam3 = 16.0291,
+               cam4 = 34.5891,
+               cam5 = 84.3194,
+               cam6 = 145.6476;
+        double s = g_displayS;
 
         math::Vec3f camPos;
-        math::Vec3f cartPos = g_curve[curveVertexID];
+        math::Vec3f cartPos = getPointAt(g_simulation, s);
         math::Vec3f worldUp = math::Vec3f(0, 1.0, 0);
 
         // change camera depending on where the train is on the track
-        if (curveVertexID >= cam1 || curveVertexID < cam2) {
+        if (s >= cam1 || s < cam2) {
             camPos = math::Vec3f(-10.0, 5.0, 10.0);
             g_camera = glLookAtCamera(camPos, cartPos, worldUp);
-        } else if (curveVertexID >= cam2 && curveVertexID < cam3) {
+        } else if (s >= cam2 && s < cam3) {
             camPos = math::Vec3f(-7.0, 6.0, 0.5);
             g_camera = glLookAtCamera(camPos, cartPos, worldUp);
-        } else if (curveVertexID >= cam3 && curveVertexID < cam4) {
+        } else if (s >= cam3 && s < cam4) {
             camPos = math::Vec3f(0.0, 2.0, -6.5);
             g_camera = glLookAtCamera(camPos, cartPos, worldUp);
-        } else if (curveVertexID >= cam4 && curveVertexID < cam5) {
+        } else if (s >= cam4 && s < cam5) {
             camPos = math::Vec3f(-1.0, 1.0, 3.0);
             g_camera = glLookAtCamera(camPos, cartPos, worldUp);
-        } else if (curveVertexID >= cam5 && curveVertexID < cam6) {
+        } else if (s >= cam5 && s < cam6) {
             camPos = math::Vec3f(-5.0, 0.1, 0.0);
             g_camera = glLookAtCamera(camPos, cartPos, worldUp);
-        } else if (curveVertexID >= cam6 && curveVertexID < cam1) {
+        } else if (s >= cam6 && s < cam1) {
             camPos = math::Vec3f(3.0, 1.0, 0.0);
             g_camera = glLookAtCamera(camPos, cartPos, worldUp);
         }
@@ -724,6 +1007,18 @@ openGL::scene::Camera glLookAtCamera(math::Vec3f cam, math::Vec3f lookAtObj, mat
 
 //==================== CALLBACK FUNCTIONS ====================//
 
+namespace {
+
+SimulationCommand cameraMove(openGL::scene::CameraUpdate::Flag flag, bool set) {
+    SimulationCommand command;
+    command.type = SimulationCommand::CAMERA_MOVE;
+    command.value = flag;
+    command.set = set;
+    return command;
+}
+
+} // namespace
+
 /**
  * To return the GLFW error code
  *
@@ -769,7 +1064,7 @@ void windowSetFramebufferSizeFunc(GLFWwindow *window, int width, int height) {
  * provided in CPSC 587 and modified by Glenn Skelton.
  */
 void windowMouseButtonFunc(GLFWwindow *window, int button, int action, int mods) {
-    if (prog->CAMERA_ANGLE != CAR) { // as long as we are not in first person, allow modification
+    if (prog->g_snapshots.front().angle != CAR) { // as long as we are not in first person, allow modification
         if (button == GLFW_MOUSE_BUTTON_LEFT) {
             if (action == GLFW_PRESS) {
                 prog->g_cursorLocked = GL_TRUE;
@@ -788,13 +1083,13 @@ void windowMouseButtonFunc(GLFWwindow *window, int button, int action, int mods)
  * provided in CPSC 587.
  */
 void windowMouseMotionFunc(GLFWwindow *window, double x, double y) {
-    if (prog->CAMERA_ANGLE == DISTANT) {
+    if (prog->g_snapshots.front().angle == DISTANT) {
         if (prog->g_cursorLocked) {
-            float deltaX = (x - prog->g_cursorX) * prog->g_cursorSpeed;
-            float deltaY = (y - prog->g_cursorY) * prog->g_cursorSpeed;
-            prog->g_camera.rotateRightAroundFocus(deltaX);
-            prog->g_camera.rotateDownAroundFocus(deltaY);
-            prog->reloadViewMatrix();
+            SimulationCommand orbit;
+            orbit.type = SimulationCommand::CAMERA_ORBIT;
+            orbit.x = (x - prog->g_cursorX) * prog->g_cursorSpeed;
+            orbit.y = (y - prog->g_cursorY) * prog->g_cursorSpeed;
+            prog->sendCommand(orbit);
         }
     }
     // else it is disabled
@@ -805,7 +1100,9 @@ void windowMouseMotionFunc(GLFWwindow *window, double x, double y) {
 
 
 /**
- * To get the key input and modify the program based on which key was pressed
+ * To get the key input and modify the program based on which key was pressed.
+ * Anything touching the train, play state or camera goes to the simulation
+ * thread as a command.
  *
  * This was borrowed from Andrew Owens from the boilerplate code provided in
  * CPSC 587 and was modified by Glenn Skelton.
@@ -819,61 +1116,52 @@ void windowKeyFunc(GLFWwindow *window, int key, int scancode, int action, int mo
             glfwSetWindowShouldClose(window, GL_TRUE);
             break;
         case GLFW_KEY_W:
-            prog->g_cameraUpdate.set(CameraUpdate::moveForward, set);
+            prog->sendCommand(cameraMove(CameraUpdate::moveForward, set));
             break;
         case GLFW_KEY_S:
-            prog->g_cameraUpdate.set(CameraUpdate::moveBackward, set);
+            prog->sendCommand(cameraMove(CameraUpdate::moveBackward, set));
             break;
         case GLFW_KEY_A:
-            prog->g_cameraUpdate.set(CameraUpdate::moveLeft, set);
+            prog->sendCommand(cameraMove(CameraUpdate::moveLeft, set));
             break;
         case GLFW_KEY_D:
-            prog->g_cameraUpdate.set(CameraUpdate::moveRight, set);
+            prog->sendCommand(cameraMove(CameraUpdate::moveRight, set));
             break;
         case GLFW_KEY_Q:
-            prog->g_cameraUpdate.set(CameraUpdate::moveDown, set);
+            prog->sendCommand(cameraMove(CameraUpdate::moveDown, set));
             break;
         case GLFW_KEY_E:
-            prog->g_cameraUpdate.set(CameraUpdate::moveUp, set);
+            prog->sendCommand(cameraMove(CameraUpdate::moveUp, set));
             break;
         case GLFW_KEY_UP:
-            prog->g_cameraUpdate.set(CameraUpdate::rotateUp, set);
+            prog->sendCommand(cameraMove(CameraUpdate::rotateUp, set));
             break;
         case GLFW_KEY_DOWN:
-            prog->g_cameraUpdate.set(CameraUpdate::rotateDown, set);
+            prog->sendCommand(cameraMove(CameraUpdate::rotateDown, set));
             break;
         case GLFW_KEY_LEFT:
             if (mods == GLFW_MOD_SHIFT)
-                prog->g_cameraUpdate.set(CameraUpdate::rollLeft, set);
+                prog->sendCommand(cameraMove(CameraUpdate::rollLeft, set));
             else
-                prog->g_cameraUpdate.set(CameraUpdate::rotateLeft, set);
+                prog->sendCommand(cameraMove(CameraUpdate::rotateLeft, set));
             break;
         case GLFW_KEY_RIGHT: // there is an error with roll right but only with the left shift ******************
             if (mods == GLFW_MOD_SHIFT)
-                prog->g_cameraUpdate.set(CameraUpdate::rollRight, set);
+                prog->sendCommand(cameraMove(CameraUpdate::rollRight, set));
             else
-                prog->g_cameraUpdate.set(CameraUpdate::rotateRight, set);
+                prog->sendCommand(cameraMove(CameraUpdate::rotateRight, set));
             break;
         case GLFW_KEY_SPACE:
-            prog->g_play = set ? !prog->g_play : prog->g_play;
-
-#if SOUND_ENABLE
-            if (!prog->g_play) {
-                // turn of the music playing
-                prog->mediaPlayer->setAllSoundsPaused(true);
-                prog->liftAudioPlaying = false;
-                prog->roarAudioPlaying = false;
-            } // sound will resume on it's own in oncePerFrame()
-#endif
-
+            if (set)
+                prog->sendCommand({SimulationCommand::TOGGLE_PLAY});
             break;
         case GLFW_KEY_R:
             if (mods == GLFW_MOD_CONTROL)
-                prog->g_play = true;
+                prog->sendCommand({SimulationCommand::PLAY});
             break;
         case GLFW_KEY_F:
-            if (mods == GLFW_MOD_CONTROL && set)
-                prog->oncePerFrame();
+            if (mods == GLFW_MOD_CONTROL && set) // advance a single physics step
+                prog->sendCommand({SimulationCommand::STEP});
             break;
         case GLFW_KEY_P:
             if (mods == GLFW_MOD_CONTROL)
@@ -882,31 +1170,29 @@ void windowKeyFunc(GLFWwindow *window, int key, int scancode, int action, int mo
             break;
         case GLFW_KEY_LEFT_BRACKET:
             if (mods == GLFW_MOD_SHIFT) {
-                prog->g_rotationSpeed *= 0.5;
+                prog->sendCommand({SimulationCommand::ROTATION_SPEED, 0, false, 0.5f});
             } else {
-                prog->g_panningSpeed *= 0.5;
+                prog->sendCommand({SimulationCommand::PANNING_SPEED, 0, false, 0.5f});
             }
             break;
         case GLFW_KEY_RIGHT_BRACKET:
             if (mods == GLFW_MOD_SHIFT) {
-                prog->g_rotationSpeed *= 1.5;
+                prog->sendCommand({SimulationCommand::ROTATION_SPEED, 0, false, 1.5f});
             } else {
-                prog->g_panningSpeed *= 1.5;
+                prog->sendCommand({SimulationCommand::PANNING_SPEED, 0, false, 1.5f});
             }
             break;
 
         // CAMERA VIEW UPDATES
         case GLFW_KEY_1:
-            prog->CAMERA_ANGLE = CAR;
+            prog->sendCommand({SimulationCommand::CAMERA_ANGLE, CAR});
             break;
         case GLFW_KEY_2:
-            prog->CAMERA_ANGLE = DISTANT;
-            prog->g_camera = prog->CAM_DEFAULT; // reset to default
-            prog->reloadViewMatrix();
+            prog->sendCommand({SimulationCommand::CAMERA_ANGLE, DISTANT}); // also resets to default
             break;
         case GLFW_KEY_3:
             // camera tracks the car movement from strategic locations
-            prog->CAMERA_ANGLE = TRACKING;
+            prog->sendCommand({SimulationCommand::CAMERA_ANGLE, TRACKING});
         default:
             break;
   }
@@ -0,0 +1,172 @@
+/**
+ * Author: Glenn Skelton
+ *
+ * Simulates one lap of the ride for every combination of a set of physics
+ * parameter ranges, see ParameterSweep.h.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+
+#include "ParameterSweep.h"
+#include "threadpool.h"
+
+namespace math {
+namespace physics {
+
+/**************************************** SWEEP RANGES ***********************************************/
+
+SweepRange::SweepRange() {}
+
+SweepRange::SweepRange(double value) : first(value), last(value), count(1) {}
+
+SweepRange::SweepRange(double first, double last, unsigned int count)
+    : first(first), last(last), count(std::max(count, 1u)) {}
+
+double SweepRange::value(unsigned int i) const {
+    return count > 1 ? first + (last - first) * i / (count - 1) : first;
+}
+
+/**
+ * Expand the ranges into one run per combination, moving the lift and brakes
+ * of the track's phases where asked. Combinations that cannot be ridden (a
+ * section moved past its neighbours or off the track, a missing section or
+ * non positive speeds) are left out and counted in skipped.
+ */
+std::vector<SweepRun> sweepCombinations(const SweepRanges &ranges,
+                                        const SimulationContext &track,
+                                        unsigned int *skipped) {
+    std::vector<SweepRun> runs;
+    unsigned int invalid = 0;
+
+    for (unsigned int a = 0; a < std::max(ranges.liftSpeed.count, 1u); a++)
+    for (unsigned int b = 0; b < std::max(ranges.gravity.count, 1u); b++)
+    for (unsigned int c = 0; c < std::max(ranges.liftStart.count, 1u); c++)
+    for (unsigned int d = 0; d < std::max(ranges.decelStart.count, 1u); d++) {
+        SweepRun run;
+        run.parameters = track.parameters;
+        run.phases = track.phases;
+        if (ranges.liftSpeed.count)
+            run.parameters.liftSpeed = ranges.liftSpeed.value(a);
+        if (ranges.gravity.count)
+            run.parameters.gravity = ranges.gravity.value(b);
+
+        bool valid = run.parameters.liftSpeed > 0.0 && run.parameters.gravity > 0.0;
+        if (valid && ranges.liftStart.count)
+            valid = setPhaseStart(run.phases, LIFT, ranges.liftStart.value(c), track.length);
+        if (valid && ranges.decelStart.count)
+            valid = setPhaseStart(run.phases, END, ranges.decelStart.value(d), track.length);
+
+        if (valid)
+            runs.push_back(run);
+        else
+            invalid++;
+    }
+
+    if (skipped)
+        *skipped = invalid;
+    return runs;
+}
+
+/**************************************** RUNS ***********************************************/
+
+/**
+ * Ride one lap from the start of the lift. The acceleration is the second
+ * difference of the positions of consecutive steps, adding gravity gives the
+ * force the riders feel, which is split along the normal and binormal of the
+ * track frame at the middle position.
+ */
+RideMetrics simulateLap(const SimulationContext &context,
+                        const TrackFrames &frames,
+                        double dt,
+                        unsigned long maxSteps) {
+    RideMetrics metrics;
+    metrics.parameters = context.parameters;
+
+    TrainState train(context);
+    math::Vec3f gravity(0.0f, (float)context.parameters.gravity, 0.0f);
+    math::Vec3f p0, p1 = getPointAt(context, train.s), p2;
+    double s1 = train.s;
+    double travelled = 0.0;
+
+    for (unsigned long step = 1; step <= maxSteps; step++) {
+        double previousS = train.s;
+        stepTrain(context, train, dt);
+        travelled += wrapArcLength(context, train.s - previousS);
+        metrics.peakSpeed = std::max(metrics.peakSpeed, train.velocity);
+
+        p2 = getPointAt(context, train.s);
+        if (step >= 2) {
+            math::Vec3f force = (p2 - p1 * 2.0f + p0) / (float)(dt * dt) + gravity;
+            TrackFrame frame = getFrameAt(context, frames, s1);
+            double normalG = (force * frame.normal) / GRAVITY;
+            double lateralG = std::fabs(force * frame.binormal) / GRAVITY;
+
+            metrics.maxNormalG = step == 2 ? normalG : std::max(metrics.maxNormalG, normalG);
+            metrics.minNormalG = step == 2 ? normalG : std::min(metrics.minNormalG, normalG);
+            metrics.maxLateralG = std::max(metrics.maxLateralG, lateralG);
+        }
+        p0 = p1;
+        p1 = p2;
+        s1 = train.s;
+
+        if (travelled >= context.length) {
+            // take off the part of the last step that went past the start
+            double overshoot = travelled - context.length;
+            metrics.lapTime = step * dt - (train.velocity > 0.0 ? overshoot / train.velocity : 0.0);
+            metrics.completed = true;
+            break;
+        }
+    }
+
+    return metrics;
+}
+
+/**
+ * Simulate every run across the pool. The runs only read the shared track and
+ * frames, each gets its own context with its parameters and phases.
+ */
+std::vector<RideMetrics> runSweep(const SimulationContext &track,
+                                  const TrackFrames &frames,
+                                  const std::vector<SweepRun> &runs,
+                                  double dt,
+                                  util::ThreadPool &pool) {
+    std::vector<RideMetrics> results(runs.size());
+
+    // a lap slower than walking the whole track at a tenth of the lift speed is stuck
+    pool.parallelFor(runs.size(), [&](size_t begin, size_t end) {
+        for (size_t r = begin; r < end; r++) {
+            SimulationContext context = track; // shares the track statistics
+            context.parameters = runs[r].parameters;
+            context.setPhases(runs[r].phases);
+            const PhysicsParameters &parameters = runs[r].parameters;
+            double slowest = 0.1 * (hasPhase(runs[r].phases, STATION) ? std::min(parameters.liftSpeed, parameters.stationSpeed)
+                                                                      : parameters.liftSpeed);
+            unsigned long maxSteps = (unsigned long)std::ceil(track.length / (slowest * dt));
+            results[r] = simulateLap(context, frames, dt, maxSteps);
+            results[r].phases = runs[r].phases;
+        }
+    });
+
+    return results;
+}
+
+bool writeSweepResults(const std::string &filePath, const std::vector<RideMetrics> &results) {
+    std::ofstream out(filePath);
+    if (!out)
+        return false;
+
+    out << "liftSpeed,gravity,liftStart,decelStart,completed,lapTime,peakSpeed,maxNormalG,minNormalG,maxLateralG\n";
+    for (const RideMetrics &run : results) {
+        const PhysicsParameters &p = run.parameters;
+        out << p.liftSpeed << ',' << p.gravity << ',' << getPhaseStart(run.phases, LIFT) << ','
+            << getPhaseStart(run.phases, END) << ','
+            << run.completed << ',' << run.lapTime << ',' << run.peakSpeed << ',' << run.maxNormalG << ','
+            << run.minNormalG << ',' << run.maxLateralG << '\n';
+    }
+    return (bool)out;
+}
+
+} // namespace physics
+} // namespace math
@@ -7,6 +7,7 @@
  * John Hall for CPSC 453.
  */
 
+#include <cstddef>
 #include <vector>
 #include <iostream>
 
@@ -28,8 +29,6 @@ RenderingEngine::~RenderingEngine() {}
 void RenderingEngine::assignBuffer(Geometry &geometry) {
     glGenVertexArrays(1, &geometry.vaoID);
     glGenBuffers(1, &geometry.vertexBufferID);
-    glGenBuffers(1, &geometry.normalBufferID);
-    glGenBuffers(1, &geometry.colourBufferID);
 
     glGenBuffers(1, &geometry.indexBufferID);
 }
@@ -42,77 +41,90 @@ void RenderingEngine::assignBuffer(Geometry &geometry) {
 void RenderingEngine::deleteBuffer(Geometry &geometry) {
     glDeleteVertexArrays(1, &geometry.vaoID);
     glDeleteBuffers(1, &geometry.vertexBufferID);
-    glDeleteBuffers(1, &geometry.vertexBufferID);
-    glDeleteBuffers(1, &geometry.normalBufferID);
-    glDeleteBuffers(1, &geometry.colourBufferID);
 
     glDeleteBuffers(1, &geometry.indexBufferID);
 }
 
 /**
- * Create the VAO's and VBO's
+ * Create the VAO and point its attributes into the interleaved vertex buffer
  */
 void RenderingEngine::setBufferData(Geometry &geometry) {
-    // bind vertices
     glBindVertexArray(geometry.vaoID);
     glBindBuffer(GL_ARRAY_BUFFER, geometry.vertexBufferID);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, geometry.indexBufferID);
-    glVertexAttribPointer(0,        // attribute layout # above
-                          3,        // # of components (ie XYZ )
-                          GL_FLOAT, // type of components
-                          GL_FALSE, // need to be normalized?
-                          0,        // stride
-                          (void *)0 // array buffer offset
+
+    // bind vertices
+    glVertexAttribPointer(0,                // attribute layout # above
+                          3,                // # of components (ie XYZ )
+                          GL_FLOAT,         // type of components
+                          GL_FALSE,         // need to be normalized?
+                          sizeof(Vertex),   // stride
+                          (void *)offsetof(Vertex, position) // offset into each vertex
     );
     glEnableVertexAttribArray(0); // match layout # in shader
 
     // bind normals
-    glBindBuffer(GL_ARRAY_BUFFER, geometry.normalBufferID);
-    glVertexAttribPointer(1,        // attribute layout # above
-                          3,        // # of components (ie XYZ )
-                          GL_FLOAT, // type of components
-                          GL_FALSE, // need to be normalized?
-                          0,        // stride
-                          (void *)0 // array buffer offset
-    );
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)offsetof(Vertex, normal));
     glEnableVertexAttribArray(1);
 
     // bind colours
-    glBindBuffer(GL_ARRAY_BUFFER, geometry.colourBufferID);
-    glVertexAttribPointer(2,        // attribute layout # above
-                          3,        // # of components (ie XYZ )
-                          GL_FLOAT, // type of components
-                          GL_FALSE, // need to be normalized?
-                          0,        // stride
-                          (void *)0 // array buffer offset
-    );
+    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)offsetof(Vertex, colour));
     glEnableVertexAttribArray(2);
 
     glBindVertexArray(0); // reset to default
 }
 
+/**
+ * Send the vertices of a mesh to its vertex buffer in one upload
+ */
+void RenderingEngine::uploadVertices(Geometry &geometry) {
+    glBindBuffer(GL_ARRAY_BUFFER, geometry.vertexBufferID);
+    glBufferData(GL_ARRAY_BUFFER,
+                 sizeof(Vertex) * geometry.vertices.size(), // byte size of every vertex
+                 geometry.vertices.data(), // pointer (Vertex*) to contents of vertices
+                 GL_STATIC_DRAW); // Usage pattern of GPU buffer
+    geometry.verticesCount = geometry.vertices.size();
+}
+
 /**
  * This goes through the trouble of loading and reloading the shader files
  *
  * Borrowed from Andrew Owens from CPSC 587 boilerplate code.
  */
 bool RenderingEngine::reloadShadersFromFile(std::vector<opengl::Program> &g_program) {
-    // will delete shaders from GPU as well (RAII)
-    g_program.clear();
+    ShaderSources sources;
+    if (!loadShaderSources(sources))
+        return false;
+    return buildShaders(sources, g_program);
+}
 
-    using namespace opengl;
-    // shader ID from OpenGL
-    //auto vsSource = loadShaderStringFromFile("./shaders/basic_vs.glsl");
-    //auto fsSource = loadShaderStringFromFile("./shaders/basic_fs.glsl");
+/**
+ * Read the shader source files. This does not touch OpenGL so it can run on
+ * any thread.
+ */
+bool RenderingEngine::loadShaderSources(ShaderSources &sources) {
+    //sources.vertex = loadShaderStringFromFile("./shaders/basic_vs.glsl");
+    //sources.fragment = loadShaderStringFromFile("./shaders/basic_fs.glsl");
 
-    auto vsSource = loadShaderStringFromFile("phong_vs.glsl");
-    auto fsSource = loadShaderStringFromFile("phong_fs.glsl");
+    sources.vertex = loadShaderStringFromFile("phong_vs.glsl");
+    sources.fragment = loadShaderStringFromFile("phong_fs.glsl");
 
-    if (vsSource.empty() || fsSource.empty()) {
+    if (sources.vertex.empty() || sources.fragment.empty()) {
         std::cerr << "Failed to load shaders from file\n";
         return false;
     }
-    auto program = makeProgram(vsSource, fsSource);
+    return true;
+}
+
+/**
+ * Compile and link the shaders, must be called on the thread with the GL context
+ */
+bool RenderingEngine::buildShaders(ShaderSources const &sources, std::vector<opengl::Program> &g_program) {
+    // will delete shaders from GPU as well (RAII)
+    g_program.clear();
+
+    using namespace opengl;
+    auto program = makeProgram(sources.vertex, sources.fragment);
     if (!program.isValid()) {
         std::cerr << "Failed to load program\n";
         return false;
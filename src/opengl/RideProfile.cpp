@@ -0,0 +1,206 @@
+/**
+ * Author: Glenn Skelton
+ *
+ * Offline speed and g force analysis of the whole ride, see RideProfile.h.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+
+#include "RideProfile.h"
+#include "TrainBatch.h"
+#include "threadpool.h"
+
+namespace math {
+namespace physics {
+
+namespace {
+
+// curve points analysed per task
+const size_t PARALLEL_GRAIN = 1 << 13;
+
+const char PROFILE_MAGIC[4] = {'C', 'R', 'P', 'F'};
+const uint32_t PROFILE_VERSION = 2;
+
+// binary profile layout, followed by sampleCount RideSample records as in memory
+struct ProfileHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t sampleCount;
+    uint32_t sampleSize; // sizeof(RideSample) of the writer
+    double liftSpeed;
+    double gravity;
+    double liftStart; // arc lengths
+    double decelStart;
+};
+
+// neighbours of i used for differences, a phase change is a step in the speed
+// model so it is never differentiated across
+void phaseNeighbours(const vector<uint8_t> &phase, unsigned int i, unsigned int &prev, unsigned int &next) {
+    unsigned int count = phase.size();
+    prev = (i + count - 1) % count;
+    next = (i + 1) % count;
+    if (phase[prev] != phase[i])
+        prev = i;
+    if (phase[next] != phase[i])
+        next = i;
+}
+
+void keepExtremum(ProfileExtremum &extremum, double value, double s, bool larger) {
+    if (larger ? value > extremum.value : value < extremum.value) {
+        extremum.value = value;
+        extremum.s = s;
+    }
+}
+
+} // namespace
+
+/**
+ * Work out the speed and felt forces at every curve point. The speed follows
+ * v(), taking each braking section down from the speed at the end of its fall.
+ * The acceleration is v dv/ds along the tangent plus v^2 times the curvature
+ * of the spline at the point, which avoids differencing positions that are only
+ * a millimetre apart. Adding gravity back gives the force on the riders, which
+ * is split along the track frames.
+ */
+RideProfile analyzeRide(const Track &track,
+                        const SimulationContext &context,
+                        const TrackFrames &frames,
+                        util::ThreadPool &pool) {
+    RideProfile profile;
+    profile.parameters = context.parameters;
+    profile.phases = context.phases;
+
+    const math::geometry::Curve &curve = *context.curve;
+    unsigned int count = curve.pointCount();
+    if (count < 3 || track.parameters.size() != count || frames.size() != count)
+        return profile;
+
+    // each brake slows down from the speed of the fall right before it, a
+    // brake that does not follow a fall starts from rest
+    SpeedTable table(context);
+    vector<double> fallVelocity(context.phases.size(), 0.0);
+    for (unsigned int i = 0; i < count; i++) {
+        unsigned int prev = (i + count - 1) % count;
+        if (table.phase[i] == END && table.phase[prev] == FALL)
+            fallVelocity[context.rangeOf[i]] = table.base[prev];
+    }
+
+    vector<double> speed(count);
+    for (unsigned int i = 0; i < count; i++)
+        speed[i] = table.base[i] + table.brake[i] * fallVelocity[context.rangeOf[i]];
+
+    profile.samples.resize(count);
+    vector<math::Vec3f> felt(count); // force on the riders per unit mass
+    math::Vec3f gravity(0.0f, (float)context.parameters.gravity, 0.0f);
+
+    pool.parallelFor(count, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            double t = track.parameters[i];
+            math::Vec3f d1 = track.spline.firstDerivative(t);
+            math::Vec3f d2 = track.spline.secondDerivative(t);
+            float rate = norm(d1);
+            math::Vec3f tangent = d1 / rate;
+            math::Vec3f curvature = (d2 - tangent * (d2 * tangent)) / (rate * rate);
+
+            unsigned int prev, next;
+            phaseNeighbours(table.phase, i, prev, next);
+            double v = speed[i];
+            double dvds = next != prev ? (speed[next] - speed[prev]) / (((next != i) + (prev != i)) * context.deltaS) : 0.0;
+
+            felt[i] = tangent * (float)(v * dvds) + curvature * (float)(v * v) + gravity;
+
+            const TrackFrame &frame = frames[i];
+            RideSample &sample = profile.samples[i];
+            sample.s = (float)(i * context.deltaS);
+            sample.speed = (float)v;
+            sample.tangentialG = (float)((felt[i] * frame.tangent) / GRAVITY);
+            sample.normalG = (float)((felt[i] * frame.normal) / GRAVITY);
+            sample.lateralG = (float)((felt[i] * frame.binormal) / GRAVITY);
+            sample.phase = table.phase[i];
+        }
+    }, PARALLEL_GRAIN);
+
+    // jerk is how fast the felt force changes as the train moves past the point
+    pool.parallelFor(count, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            unsigned int prev, next;
+            phaseNeighbours(table.phase, i, prev, next);
+            double ds = ((next != i) + (prev != i)) * context.deltaS;
+            profile.samples[i].jerk = ds > 0.0 ? (float)(speed[i] * norm(felt[next] - felt[prev]) / ds / GRAVITY) : 0.f;
+        }
+    }, PARALLEL_GRAIN);
+
+    profile.summary = summarizeProfile(profile.samples);
+    return profile;
+}
+
+/**
+ * Find the extremes of every quantity in a profile
+ */
+ProfileSummary summarizeProfile(const vector<RideSample> &samples) {
+    ProfileSummary summary;
+    if (samples.empty())
+        return summary;
+
+    const RideSample &first = samples.front();
+    summary.maxSpeed = {first.speed, first.s};
+    summary.maxTangentialG = summary.minTangentialG = {first.tangentialG, first.s};
+    summary.maxNormalG = summary.minNormalG = {first.normalG, first.s};
+    summary.maxLateralG = {std::fabs(first.lateralG), first.s};
+    summary.maxJerk = {first.jerk, first.s};
+
+    for (const RideSample &sample : samples) {
+        keepExtremum(summary.maxSpeed, sample.speed, sample.s, true);
+        keepExtremum(summary.maxTangentialG, sample.tangentialG, sample.s, true);
+        keepExtremum(summary.minTangentialG, sample.tangentialG, sample.s, false);
+        keepExtremum(summary.maxNormalG, sample.normalG, sample.s, true);
+        keepExtremum(summary.minNormalG, sample.normalG, sample.s, false);
+        keepExtremum(summary.maxLateralG, std::fabs(sample.lateralG), sample.s, true);
+        keepExtremum(summary.maxJerk, sample.jerk, sample.s, true);
+    }
+    return summary;
+}
+
+bool writeProfileCSV(const string &filePath, const RideProfile &profile) {
+    std::ofstream out(filePath);
+    if (!out)
+        return false;
+
+    out << "s,phase,speed,tangentialG,normalG,lateralG,jerk\n";
+    for (const RideSample &sample : profile.samples) {
+        out << sample.s << ',' << (int)sample.phase << ',' << sample.speed << ',' << sample.tangentialG << ','
+            << sample.normalG << ',' << sample.lateralG << ',' << sample.jerk << '\n';
+    }
+    return (bool)out;
+}
+
+/**
+ * Write the profile as a small header followed by the raw samples, for tools
+ * that load the whole track at once.
+ */
+bool writeProfileBinary(const string &filePath, const RideProfile &profile) {
+    std::ofstream out(filePath, std::ios::binary | std::ios::trunc);
+    if (!out)
+        return false;
+
+    ProfileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, PROFILE_MAGIC, sizeof(PROFILE_MAGIC));
+    header.version = PROFILE_VERSION;
+    header.sampleCount = profile.samples.size();
+    header.sampleSize = sizeof(RideSample);
+    header.liftSpeed = profile.parameters.liftSpeed;
+    header.gravity = profile.parameters.gravity;
+    header.liftStart = getPhaseStart(profile.phases, LIFT);
+    header.decelStart = getPhaseStart(profile.phases, END);
+
+    out.write(reinterpret_cast<char const *>(&header), sizeof(header));
+    out.write(reinterpret_cast<char const *>(profile.samples.data()), profile.samples.size() * sizeof(RideSample));
+    return (bool)out;
+}
+
+} // namespace physics
+} // namespace math
@@ -0,0 +1,193 @@
+/**
+ * Author: Glenn Skelton
+ *
+ * Height statistics of a track with constant time range queries, see
+ * TrackStats.h.
+ */
+
+#include <cmath>
+
+#include "TrackStats.h"
+
+namespace math {
+namespace physics {
+
+namespace {
+
+// points per block, a query inside one block just scans it
+const unsigned int BLOCK = 32;
+
+unsigned int floorLog2(unsigned int x) {
+    unsigned int k = 0;
+    while (x >>= 1)
+        k++;
+    return k;
+}
+
+} // namespace
+
+TrackStats::TrackStats() {}
+
+TrackStats::TrackStats(const math::geometry::Curve &curve) {
+    unsigned int count = curve.pointCount();
+    if (count == 0)
+        return;
+
+    const float *heights = curve.soa().y();
+    m_heights.assign(heights, heights + count);
+    m_deltaS = curve.length() / (double)count;
+
+    // ties go to the earlier point so the results match a linear scan
+    const std::vector<float> &h = m_heights;
+    build(m_highest, [&h](unsigned int a, unsigned int b) { return h[a] > h[b] || (h[a] == h[b] && a < b); });
+    build(m_lowest, [&h](unsigned int a, unsigned int b) { return h[a] < h[b] || (h[a] == h[b] && a < b); });
+}
+
+template <typename Better>
+void TrackStats::build(Table &table, Better better) const {
+    unsigned int count = m_heights.size();
+    unsigned int blockCount = (count + BLOCK - 1) / BLOCK;
+    auto pick = [&better](unsigned int a, unsigned int b) { return better(b, a) ? b : a; };
+
+    table.fromBlockStart.resize(count);
+    table.toBlockEnd.resize(count);
+    for (unsigned int i = 0; i < count; i++)
+        table.fromBlockStart[i] = i % BLOCK == 0 ? i : pick(table.fromBlockStart[i - 1], i);
+    for (unsigned int i = count; i-- > 0;)
+        table.toBlockEnd[i] = (i % BLOCK == BLOCK - 1 || i == count - 1) ? i : pick(i, table.toBlockEnd[i + 1]);
+
+    table.blocks.assign(1, std::vector<unsigned int>(blockCount));
+    for (unsigned int b = 0; b < blockCount; b++)
+        table.blocks[0][b] = table.toBlockEnd[b * BLOCK];
+
+    for (unsigned int k = 1; (1u << k) <= blockCount; k++) {
+        const std::vector<unsigned int> &below = table.blocks[k - 1];
+        unsigned int span = 1u << k;
+        std::vector<unsigned int> level(blockCount - span + 1);
+        for (unsigned int b = 0; b + span <= blockCount; b++)
+            level[b] = pick(below[b], below[b + span / 2]);
+        table.blocks.push_back(std::move(level));
+    }
+}
+
+/**
+ * Best point of first..last (first <= last). The partial blocks at either end
+ * come from the per point tables and the whole blocks between from two
+ * overlapping entries of the sparse table.
+ */
+template <typename Better>
+unsigned int TrackStats::query(const Table &table, Better better, unsigned int first, unsigned int last) const {
+    auto pick = [&better](unsigned int a, unsigned int b) { return better(b, a) ? b : a; };
+    unsigned int firstBlock = first / BLOCK;
+    unsigned int lastBlock = last / BLOCK;
+
+    if (firstBlock == lastBlock) {
+        unsigned int best = first;
+        for (unsigned int i = first + 1; i <= last; i++)
+            best = pick(best, i);
+        return best;
+    }
+
+    unsigned int best = pick(table.toBlockEnd[first], table.fromBlockStart[last]);
+    if (lastBlock - firstBlock > 1) {
+        unsigned int span = lastBlock - firstBlock - 1;
+        unsigned int k = floorLog2(span);
+        const std::vector<unsigned int> &level = table.blocks[k];
+        best = pick(best, pick(level[firstBlock + 1], level[lastBlock - (1u << k)]));
+    }
+    return best;
+}
+
+unsigned int TrackStats::pointCount() const { return m_heights.size(); }
+
+HeightSample TrackStats::highest() const { return highest(0, pointCount() - 1); }
+
+HeightSample TrackStats::lowest() const { return lowest(0, pointCount() - 1); }
+
+HeightSample TrackStats::highest(unsigned int first, unsigned int last) const {
+    HeightSample sample;
+    if (m_heights.empty())
+        return sample;
+
+    const std::vector<float> &h = m_heights;
+    auto better = [&h](unsigned int a, unsigned int b) { return h[a] > h[b] || (h[a] == h[b] && a < b); };
+    if (first <= last) {
+        sample.index = query(m_highest, better, first, last);
+    } else {
+        unsigned int a = query(m_highest, better, first, pointCount() - 1);
+        unsigned int b = query(m_highest, better, 0, last);
+        sample.index = better(b, a) ? b : a;
+    }
+    sample.height = h[sample.index];
+    return sample;
+}
+
+HeightSample TrackStats::lowest(unsigned int first, unsigned int last) const {
+    HeightSample sample;
+    if (m_heights.empty())
+        return sample;
+
+    const std::vector<float> &h = m_heights;
+    auto better = [&h](unsigned int a, unsigned int b) { return h[a] < h[b] || (h[a] == h[b] && a < b); };
+    if (first <= last) {
+        sample.index = query(m_lowest, better, first, last);
+    } else {
+        unsigned int a = query(m_lowest, better, first, pointCount() - 1);
+        unsigned int b = query(m_lowest, better, 0, last);
+        sample.index = better(b, a) ? b : a;
+    }
+    sample.height = h[sample.index];
+    return sample;
+}
+
+double TrackStats::wrap(double s) const {
+    double length = m_deltaS * pointCount();
+    s = std::fmod(s, length);
+    return s < 0.0 ? s + length : s;
+}
+
+/**
+ * Curve point at or just before the arc length s
+ */
+unsigned int TrackStats::pointAt(double s) const {
+    unsigned int index = (unsigned int)(wrap(s) / m_deltaS);
+    return index < pointCount() ? index : pointCount() - 1;
+}
+
+/**
+ * The curve points from the first one at or after s0 to the last one at or
+ * before s1, or just the point before s0 when the interval holds none.
+ */
+void TrackStats::pointsBetween(double s0, double s1, unsigned int &first, unsigned int &last) const {
+    s0 = wrap(s0);
+    double span = wrap(s1 - s0);
+
+    first = pointAt(s0);
+    last = first;
+    unsigned int next = (first + 1) % pointCount();
+    if (first * m_deltaS < s0) {
+        if (wrap(next * m_deltaS - s0) > span)
+            return;
+        first = next;
+    }
+    last = pointAt(s1);
+}
+
+HeightSample TrackStats::highestBetween(double s0, double s1) const {
+    if (m_heights.empty())
+        return HeightSample();
+    unsigned int first, last;
+    pointsBetween(s0, s1, first, last);
+    return highest(first, last);
+}
+
+HeightSample TrackStats::lowestBetween(double s0, double s1) const {
+    if (m_heights.empty())
+        return HeightSample();
+    unsigned int first, last;
+    pointsBetween(s0, s1, first, last);
+    return lowest(first, last);
+}
+
+} // namespace physics
+} // namespace math
@@ -0,0 +1,177 @@
+/**
+ * Author: Glenn Skelton
+ *
+ * Steps many independent trains on one track at once, see TrainBatch.h.
+ */
+
+#include <algorithm>
+
+#include "TrainBatch.h"
+#include "threadpool.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define TRAIN_BATCH_SSE2 1
+#endif
+
+namespace math {
+namespace physics {
+
+namespace {
+
+// trains stepped per task, small batches are not worth waking the pool for
+const size_t PARALLEL_GRAIN = 1 << 12;
+
+} // namespace
+
+/**************************************** SPEED TABLE ***********************************************/
+
+SpeedTable::SpeedTable() {}
+
+/**
+ * Evaluate the phase logic of v() once for every point. Lift and fall speeds
+ * only depend on the point, the braking speed is the speed the train carried
+ * out of the fall scaled by how far along the brakes the point is.
+ */
+SpeedTable::SpeedTable(const SimulationContext &context) {
+    const math::geometry::Curve &curve = *context.curve;
+    const PhysicsParameters &parameters = context.parameters;
+    unsigned int count = curve.pointCount();
+
+    base.resize(count);
+    brake.resize(count);
+    phase.resize(count);
+
+    for (unsigned int i = 0; i < count; i++) {
+        PHASE p = getPhase(context, i);
+        phase[i] = (uint8_t)p;
+        base[i] = 0.0;
+        brake[i] = 0.0;
+
+        switch (p) {
+        case LIFT:
+            base[i] = parameters.liftSpeed;
+            break;
+        case FALL:
+            base[i] = getFreefallVelocity(context.maxHeight, curve[i].m_y, parameters.gravity) + parameters.liftSpeed / 2;
+            break;
+        case END: {
+            unsigned int range = context.rangeOf[i];
+            brake[i] = getDecelerationVelocity(getBrakeStart(context, range), curve[i], getBrakeEnd(context, range), 1.0);
+            break;
+        }
+        case STATION:
+            base[i] = parameters.stationSpeed;
+            break;
+        }
+    }
+}
+
+/**************************************** TRAIN BATCH ***********************************************/
+
+TrainBatch::TrainBatch() {}
+
+TrainBatch::TrainBatch(const SimulationContext &context) : m_context(&context), m_speeds(context) {}
+
+size_t TrainBatch::size() const { return m_s.size(); }
+
+void TrainBatch::addTrain(const TrainState &state) {
+    m_s.push_back(state.s);
+    m_velocity.push_back(state.velocity);
+    m_fallVelocity.push_back(state.fallVelocity);
+    m_index.push_back(state.index);
+    m_phase.push_back((uint8_t)state.phase);
+}
+
+TrainState TrainBatch::train(size_t i) const {
+    TrainState state;
+    state.s = m_s[i];
+    state.velocity = m_velocity[i];
+    state.fallVelocity = m_fallVelocity[i];
+    state.index = m_index[i];
+    state.phase = (PHASE)m_phase[i];
+    return state;
+}
+
+void TrainBatch::clear() {
+    m_s.clear();
+    m_velocity.clear();
+    m_fallVelocity.clear();
+    m_index.clear();
+    m_phase.clear();
+}
+
+/**
+ * Advance every train by one time step, matching stepTrain() exactly.
+ */
+void TrainBatch::step(double dt) { stepRange(0, size(), dt); }
+
+void TrainBatch::step(double dt, util::ThreadPool &pool) {
+    pool.parallelFor(size(), [this, dt](size_t begin, size_t end) { stepRange(begin, end, dt); }, PARALLEL_GRAIN);
+}
+
+/**
+ * The same update as stepTrain() in two passes. The first looks the speed up
+ * in the table per train, the fall speed is only replaced on points in the
+ * fall. The second advances s and the point index from that speed, two trains
+ * per SSE2 instruction since the wrap and clamp make the loop too branchy for
+ * the compiler to vectorize on its own.
+ */
+void TrainBatch::stepRange(size_t begin, size_t end, double dt) {
+    const double *base = m_speeds.base.data();
+    const double *brake = m_speeds.brake.data();
+    const uint8_t *phaseOf = m_speeds.phase.data();
+    const double length = m_context->length;
+    const double deltaS = m_context->deltaS;
+    const unsigned int last = m_context->curve->pointCount() - 1;
+
+    double *s = m_s.data();
+    double *velocity = m_velocity.data();
+    double *fallVelocity = m_fallVelocity.data();
+    unsigned int *index = m_index.data();
+    uint8_t *phase = m_phase.data();
+
+    for (size_t k = begin; k < end; k++) {
+        unsigned int i = index[k];
+        uint8_t p = phaseOf[i];
+        double speed = base[i] + brake[i] * fallVelocity[k];
+        fallVelocity[k] = p == FALL ? speed : fallVelocity[k];
+
+        phase[k] = p;
+        velocity[k] = speed;
+    }
+
+    size_t k = begin;
+#if defined(TRAIN_BATCH_SSE2)
+    // clamping the index before truncating is the same as after since s >= 0
+    const __m128d step = _mm_set1_pd(dt);
+    const __m128d wrap = _mm_set1_pd(length);
+    const __m128d spacing = _mm_set1_pd(deltaS);
+    const __m128d lastIndex = _mm_set1_pd((double)last);
+    for (; k + 2 <= end; k += 2) {
+        __m128d next = _mm_add_pd(_mm_loadu_pd(s + k), _mm_mul_pd(_mm_loadu_pd(velocity + k), step)); // getDistance()
+        next = _mm_sub_pd(next, _mm_and_pd(_mm_cmpge_pd(next, wrap), wrap)); // a step is always shorter than the track
+        __m128i nextIndex = _mm_cvttpd_epi32(_mm_min_pd(_mm_div_pd(next, spacing), lastIndex));
+
+        _mm_storeu_pd(s + k, next);
+        _mm_storel_epi64((__m128i *)(index + k), nextIndex);
+    }
+#endif
+    for (; k < end; k++) {
+        double next = s[k] + getDistance(velocity[k], dt);
+        next = next >= length ? next - length : next;
+        unsigned int nextIndex = (unsigned int)(next / deltaS);
+
+        s[k] = next;
+        index[k] = std::min(nextIndex, last);
+    }
+}
+
+double const *TrainBatch::s() const { return m_s.data(); }
+
+double const *TrainBatch::velocity() const { return m_velocity.data(); }
+
+unsigned int const *TrainBatch::index() const { return m_index.data(); }
+
+} // namespace physics
+} // namespace math
@@ -0,0 +1,337 @@
+/**
+ * Author: Glenn Skelton
+ *
+ * Runs the roller coaster physics without a window, GL context or audio so
+ * rides can be analysed on machines without a display. The track is loaded and
+ * processed exactly as the viewer does it (sharing its cache), then the train
+ * is stepped for a number of laps or a length of simulated time. The step rate
+ * is reported and the trajectory can be written out as CSV. With --trains the
+ * given number of trains, spread evenly around the track, are stepped together
+ * as a batch and the rate is reported in train steps per second.
+ *
+ * Giving any of the physics parameters runs a sweep instead, one lap for every
+ * combination of the values, with the metrics of each run written to --output.
+ * A parameter is a single value or first:last:count, the lift and brake starts
+ * are arc lengths that move those sections of the track's phases.
+ *
+ * --profile analyses the whole track instead, writing the speed, g forces and
+ * jerk at every curve point (as CSV, or raw binary when the file ends in .bin)
+ * and printing where the extremes are.
+ *
+ * usage: coasterHeadless [--track file.obj] [--cache file] [--laps n]
+ *                        [--duration seconds] [--dt seconds] [--output file.csv]
+ *                        [--trains n] [--lift-speed r] [--gravity r]
+ *                        [--lift-start r] [--decel-start r] [--profile file]
+ */
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "CoasterPhysics.h"
+#include "ParameterSweep.h"
+#include "RideProfile.h"
+#include "TrainBatch.h"
+#include "threadpool.h"
+
+using namespace std;
+using namespace math::physics;
+
+namespace {
+
+struct Options {
+    string trackPath = "./curves/rollerCoaster.obj";
+    string cachePath = "./curves/rollerCoaster.cache";
+    string outputPath; // no trajectory is kept when empty
+    unsigned int laps = 1;
+    double duration = 0.0; // simulated seconds, overrides laps when set
+    double dt = 0.015; // same step as the viewer
+    unsigned int samplesPerUnit = 1000;
+    unsigned int trains = 1; // more than one steps a batch, the trajectory is of the first
+    bool sweep = false; // a physics parameter was given
+    SweepRanges ranges;
+    string profilePath; // analyse the whole track when set
+    unsigned int bankSmoothing = 250; // same frames as the viewer
+};
+
+// state of the train after one step
+struct TrajectorySample {
+    double time;
+    double s;
+    unsigned int index;
+    PHASE phase;
+    double velocity;
+    math::Vec3f position;
+};
+
+// longest run in laps mode, in case a track never brings the train around
+const unsigned long MAX_STEPS_PER_LAP = 10000000;
+
+void usage(const char *name) {
+    cerr << "usage: " << name << " [--track file.obj] [--cache file] [--laps n]"
+         << " [--duration seconds] [--dt seconds] [--output file.csv] [--trains n]"
+         << " [--lift-speed r] [--gravity r] [--lift-start r] [--decel-start r] [--profile file]" << endl;
+    cerr << "a sweep parameter r is a single value or first:last:count" << endl;
+}
+
+bool parseRange(const char *value, SweepRange &range) {
+    double first, last;
+    unsigned int count;
+    char end;
+    if (sscanf(value, "%lf:%lf:%u%c", &first, &last, &count, &end) == 3 && count > 0) {
+        range = SweepRange(first, last, count);
+        return true;
+    }
+    if (sscanf(value, "%lf%c", &first, &end) == 1) {
+        range = SweepRange(first);
+        return true;
+    }
+    cerr << "bad range " << value << endl;
+    return false;
+}
+
+bool parseArguments(int argc, char *argv[], Options &options) {
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--help" || arg == "-h")
+            return false;
+        if (i + 1 >= argc) {
+            cerr << "missing value for " << arg << endl;
+            return false;
+        }
+
+        const char *value = argv[++i];
+        if (arg == "--track")
+            options.trackPath = value;
+        else if (arg == "--cache")
+            options.cachePath = value;
+        else if (arg == "--output")
+            options.outputPath = value;
+        else if (arg == "--laps")
+            options.laps = (unsigned int)strtoul(value, nullptr, 10);
+        else if (arg == "--duration")
+            options.duration = strtod(value, nullptr);
+        else if (arg == "--dt")
+            options.dt = strtod(value, nullptr);
+        else if (arg == "--trains")
+            options.trains = (unsigned int)strtoul(value, nullptr, 10);
+        else if (arg == "--profile")
+            options.profilePath = value;
+        else if (arg == "--lift-speed" || arg == "--gravity" || arg == "--lift-start" || arg == "--decel-start") {
+            SweepRange &range = arg == "--lift-speed" ? options.ranges.liftSpeed
+                              : arg == "--gravity" ? options.ranges.gravity
+                              : arg == "--lift-start" ? options.ranges.liftStart
+                              : options.ranges.decelStart;
+            if (!parseRange(value, range))
+                return false;
+            options.sweep = true;
+        } else {
+            cerr << "unknown option " << arg << endl;
+            return false;
+        }
+    }
+
+    if (options.dt <= 0.0 || options.trains == 0 || (options.duration <= 0.0 && options.laps == 0)) {
+        cerr << "nothing to simulate, check --dt, --laps, --duration and --trains" << endl;
+        return false;
+    }
+    return true;
+}
+
+bool writeTrajectory(const string &filePath, const vector<TrajectorySample> &trajectory) {
+    ofstream out(filePath);
+    if (!out)
+        return false;
+
+    out << "time,s,index,phase,velocity,x,y,z\n";
+    for (const TrajectorySample &sample : trajectory) {
+        out << sample.time << ',' << sample.s << ',' << sample.index << ',' << sample.phase << ','
+            << sample.velocity << ',' << sample.position.m_x << ',' << sample.position.m_y << ','
+            << sample.position.m_z << '\n';
+    }
+    return (bool)out;
+}
+
+/**
+ * Ride one lap for every combination of the parameter ranges across all cores
+ * and write the metrics of every run.
+ */
+int runParameterSweep(const Options &options, const Track &track, const SimulationContext &context) {
+    using Clock = std::chrono::steady_clock;
+
+    TrackFrames frames = computeBankedFrames(track.curve, track.phases, options.dt, options.bankSmoothing);
+    unsigned int skipped = 0;
+    vector<SweepRun> runs = sweepCombinations(options.ranges, context, &skipped);
+    util::ThreadPool &pool = util::defaultThreadPool();
+
+    Clock::time_point runStart = Clock::now();
+    vector<RideMetrics> results = runSweep(context, frames, runs, options.dt, pool);
+    double runSeconds = std::chrono::duration<double>(Clock::now() - runStart).count();
+
+    size_t completed = 0;
+    for (const RideMetrics &run : results)
+        completed += run.completed ? 1 : 0;
+
+    cout << "swept " << runs.size() << " runs (" << skipped << " invalid combinations skipped, "
+         << runs.size() - completed << " did not finish a lap) on " << pool.threadCount() << " threads in "
+         << runSeconds << " s, " << (runSeconds > 0.0 ? runs.size() / runSeconds : 0.0) << " runs/s" << endl;
+
+    if (options.outputPath.empty()) {
+        cerr << "no --output given, sweep results not written" << endl;
+    } else if (!writeSweepResults(options.outputPath, results)) {
+        cerr << "could not write sweep results " << options.outputPath << endl;
+        return EXIT_FAILURE;
+    } else {
+        cout << "sweep results written to " << options.outputPath << endl;
+    }
+    return EXIT_SUCCESS;
+}
+
+void printExtremum(const char *name, const ProfileExtremum &extremum) {
+    cout << "  " << name << " " << extremum.value << " at s = " << extremum.s << endl;
+}
+
+/**
+ * Work out the forces over the whole track, print the extremes and write the
+ * profile.
+ */
+int runRideProfile(const Options &options, const Track &track, const SimulationContext &context) {
+    using Clock = std::chrono::steady_clock;
+
+    TrackFrames frames = computeBankedFrames(track.curve, track.phases, options.dt, options.bankSmoothing);
+
+    Clock::time_point runStart = Clock::now();
+    RideProfile profile = analyzeRide(track, context, frames, util::defaultThreadPool());
+    double runSeconds = std::chrono::duration<double>(Clock::now() - runStart).count();
+    if (profile.samples.empty()) {
+        cerr << "could not analyse track " << options.trackPath << endl;
+        return EXIT_FAILURE;
+    }
+
+    const ProfileSummary &summary = profile.summary;
+    cout << "analysed " << profile.samples.size() << " points in " << runSeconds << " s" << endl;
+    printExtremum("max speed (m/s)", summary.maxSpeed);
+    printExtremum("max tangential (g)", summary.maxTangentialG);
+    printExtremum("min tangential (g)", summary.minTangentialG);
+    printExtremum("max normal (g)", summary.maxNormalG);
+    printExtremum("min normal (g)", summary.minNormalG);
+    printExtremum("max lateral (g)", summary.maxLateralG);
+    printExtremum("max jerk (g/s)", summary.maxJerk);
+
+    // how high and low every section of the track goes
+    const PhaseLayout &phases = context.phases;
+    for (unsigned int r = 0; r < phases.size(); r++) {
+        double start = phases[r].start;
+        double end = phases[(r + 1) % phases.size()].start;
+        HeightSample lowest = context.stats->lowestBetween(start, end);
+        HeightSample highest = context.stats->highestBetween(start, end);
+        cout << "  " << getPhaseName(phases[r].phase) << " from s = " << start << " to " << end
+             << ": lowest " << lowest.height << " at s = " << lowest.index * context.deltaS
+             << ", highest " << highest.height << " at s = " << highest.index * context.deltaS << endl;
+    }
+
+    const string &path = options.profilePath;
+    bool binary = path.size() >= 4 && path.compare(path.size() - 4, 4, ".bin") == 0;
+    if (!(binary ? writeProfileBinary(path, profile) : writeProfileCSV(path, profile))) {
+        cerr << "could not write profile " << path << endl;
+        return EXIT_FAILURE;
+    }
+    cout << "profile written to " << path << endl;
+    return EXIT_SUCCESS;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    using Clock = std::chrono::steady_clock;
+
+    Options options;
+    if (!parseArguments(argc, argv, options)) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    Clock::time_point loadStart = Clock::now();
+    Track track;
+    if (!loadTrack(options.trackPath, options.cachePath, options.samplesPerUnit, track))
+        return EXIT_FAILURE;
+    SimulationContext context(track.curve, track.phases);
+    double loadSeconds = std::chrono::duration<double>(Clock::now() - loadStart).count();
+
+    if (options.sweep)
+        return runParameterSweep(options, track, context);
+    if (!options.profilePath.empty())
+        return runRideProfile(options, track, context);
+
+    // run for the requested time, or until the train has come around enough times
+    bool timed = options.duration > 0.0;
+    unsigned long maxSteps = timed ? (unsigned long)ceil(options.duration / options.dt)
+                                   : options.laps * MAX_STEPS_PER_LAP;
+    bool record = !options.outputPath.empty();
+
+    vector<TrajectorySample> trajectory;
+    if (record && timed)
+        trajectory.reserve(maxSteps);
+
+    // the first train starts at the lift and the rest are spaced out behind it
+    bool batched = options.trains > 1;
+    TrainBatch batch(context);
+    if (batched) {
+        for (unsigned int k = 0; k < options.trains; k++) {
+            TrainState state(context);
+            state.s = wrapArcLength(context, state.s - k * context.length / options.trains);
+            state.index = getIndex(context, state.s);
+            batch.addTrain(state);
+        }
+    }
+    util::ThreadPool &pool = util::defaultThreadPool();
+
+    TrainState train(context);
+    double travelled = 0.0; // arc length covered by the first train
+    unsigned int laps = 0;
+    unsigned long steps = 0;
+
+    Clock::time_point runStart = Clock::now();
+    while (steps < maxSteps && (timed || laps < options.laps)) {
+        double previousS = train.s;
+        if (batched) {
+            batch.step(options.dt, pool);
+            train = batch.train(0);
+        } else {
+            stepTrain(context, train, options.dt);
+        }
+        steps++;
+
+        travelled += wrapArcLength(context, train.s - previousS);
+        laps = (unsigned int)(travelled / context.length); // back at the start of the lift
+        if (record)
+            trajectory.push_back({steps * options.dt, train.s, train.index, train.phase, train.velocity,
+                                  getPointAt(context, train.s)});
+    }
+    double runSeconds = std::chrono::duration<double>(Clock::now() - runStart).count();
+    double trainSteps = (double)steps * options.trains;
+
+    cout << "track: " << options.trackPath << ", " << track.curve.pointCount() << " points, "
+         << context.length << " long, loaded in " << loadSeconds << " s" << endl;
+    cout << "simulated " << steps << " steps (" << steps * options.dt << " s, " << laps << " laps) in "
+         << runSeconds << " s, " << (runSeconds > 0.0 ? steps / runSeconds : 0.0) << " steps/s" << endl;
+    if (batched) {
+        cout << options.trains << " trains on " << pool.threadCount() << " threads, "
+             << (runSeconds > 0.0 ? trainSteps / runSeconds : 0.0) << " train steps/s" << endl;
+    }
+
+    if (record) {
+        if (!writeTrajectory(options.outputPath, trajectory)) {
+            cerr << "could not write trajectory " << options.outputPath << endl;
+            return EXIT_FAILURE;
+        }
+        cout << "trajectory written to " << options.outputPath << endl;
+    }
+
+    return EXIT_SUCCESS;
+}
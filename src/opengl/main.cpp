@@ -37,6 +37,9 @@
  * tutorial.
  */
 
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 
 #include "glad/glad.h"
@@ -46,11 +49,53 @@
 
 using namespace std;
 
+/**
+ * Read a rate in hertz, it has to be a positive number
+ */
+bool parseRate(const char *option, const char *value, double &rate) {
+    char *end = nullptr;
+    double r = strtod(value, &end);
+    if (end == value || *end != '\0' || !std::isfinite(r) || r <= 0.0) {
+        cerr << option << " must be a positive number of hertz, got " << value << endl;
+        return false;
+    }
+    rate = r;
+    return true;
+}
+
 /**
  * Starts the graphics program to generate and run the roller coaster program.
+ * Passing --benchmark draws frames as fast as possible and reports the frame
+ * times on exit. --sim-rate sets the physics steps per second and --render-rate
+ * the frames drawn per second, independently of each other.
  */
 int main(int argc, char* argv[]) {
+    bool benchmark = false;
+    double simulationRate = 0.0, renderRate = 0.0; // zero keeps the program's default
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--benchmark") == 0) {
+            benchmark = true;
+        } else if (strcmp(argv[i], "--sim-rate") == 0 || strcmp(argv[i], "--render-rate") == 0) {
+            if (i + 1 >= argc) {
+                cerr << "missing value for " << argv[i] << endl;
+                return EXIT_FAILURE;
+            }
+            double &rate = strcmp(argv[i], "--sim-rate") == 0 ? simulationRate : renderRate;
+            if (!parseRate(argv[i], argv[i + 1], rate))
+                return EXIT_FAILURE;
+            i++;
+        } else {
+            cerr << "usage: " << argv[0] << " [--benchmark] [--sim-rate hz] [--render-rate hz]" << endl;
+            return EXIT_FAILURE;
+        }
+    }
+
     GraphicsProgram *program = new GraphicsProgram("CPSC 587 Assignment 1");
+    program->g_benchmark = benchmark;
+    if (simulationRate > 0.0)
+        program->g_simulationRate = simulationRate;
+    if (renderRate > 0.0)
+        program->g_renderRate = renderRate;
     program->start();
     delete program;
 
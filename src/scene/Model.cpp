@@ -62,8 +62,10 @@ void modelParser(opengl::Geometry &object, string filename) {
             } else if (buffer[0] == 'f') {
                 sscanf(buffer, "f %d//%d", &t1, &t2);
 
-                object.verts.push_back(verts[t1-1]); // store the vert
-                object.normals.push_back(normals[t2-1]); // store the corresponding normal
+                Vertex vertex;
+                vertex.position = verts[t1-1]; // store the vert
+                vertex.normal = normals[t2-1]; // store the corresponding normal
+                object.vertices.push_back(vertex);
             } else continue; // ignore everything else
         }
         infile.close();
@@ -0,0 +1,124 @@
+/**
+ * Author: Glenn Skelton
+ *
+ * Dependency ordered tasks on the thread pool, see taskgraph.h.
+ */
+
+
+#include "taskgraph.h"
+#include "threadpool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+namespace util {
+
+TaskGraph::TaskId TaskGraph::add(std::string name, std::function<bool()> fn, std::vector<TaskId> const &dependencies) {
+    TaskId id = m_tasks.size();
+    m_tasks.emplace_back();
+    Task &task = m_tasks.back();
+    task.name = std::move(name);
+    task.fn = std::move(fn);
+    for (TaskId dependency : dependencies) {
+        if (dependency >= id) {
+            std::cerr << "task " << task.name << " depends on a task that is not in the graph" << std::endl;
+            continue;
+        }
+        task.dependencies.push_back(dependency);
+        m_tasks[dependency].dependents.push_back(id);
+    }
+    return id;
+}
+
+/**
+ * Every task counts down the dependencies left on the tasks after it and
+ * queues the ones that reach zero, the pool then spreads them over its workers.
+ */
+bool TaskGraph::run(ThreadPool &pool) {
+    size_t count = m_tasks.size();
+    m_finished = 0;
+    for (Task &task : m_tasks) {
+        task.waitingOn = task.dependencies.size();
+        task.skipped = false;
+        task.finished = false;
+        task.succeeded = false;
+        task.seconds = 0.0;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        if (m_tasks[i].dependencies.empty()) {
+            queue(pool, i);
+        }
+    }
+
+    while (m_finished.load(std::memory_order_acquire) < count) {
+        if (!pool.runPendingTask()) {
+            std::this_thread::yield();
+        }
+    }
+
+    return std::all_of(m_tasks.begin(), m_tasks.end(), [](Task const &task) { return task.succeeded; });
+}
+
+void TaskGraph::queue(ThreadPool &pool, TaskId id) {
+    pool.submit([this, &pool, id]() {
+        Task &task = m_tasks[id];
+        if (!task.skipped) {
+            auto start = std::chrono::steady_clock::now();
+            task.succeeded = task.fn();
+            task.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+        task.finished.store(true, std::memory_order_release);
+
+        for (TaskId dependent : task.dependents) {
+            if (!task.succeeded) {
+                m_tasks[dependent].skipped = true;
+            }
+            if (m_tasks[dependent].waitingOn.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                queue(pool, dependent);
+            }
+        }
+        m_finished.fetch_add(1, std::memory_order_release);
+    });
+}
+
+size_t TaskGraph::size() const { return m_tasks.size(); }
+
+std::string const &TaskGraph::name(TaskId task) const { return m_tasks[task].name; }
+
+bool TaskGraph::finished(TaskId task) const { return m_tasks[task].finished.load(std::memory_order_acquire); }
+
+size_t TaskGraph::finishedCount() const { return m_finished.load(std::memory_order_acquire); }
+
+bool TaskGraph::succeeded(TaskId task) const { return m_tasks[task].succeeded; }
+
+double TaskGraph::seconds(TaskId task) const { return m_tasks[task].seconds; }
+
+double TaskGraph::totalSeconds() const {
+    double total = 0.0;
+    for (Task const &task : m_tasks) {
+        total += task.seconds;
+    }
+    return total;
+}
+
+double TaskGraph::longestChainSeconds() const {
+    // dependencies always come first so one pass in order is enough
+    std::vector<double> finish(m_tasks.size(), 0.0);
+    double longest = 0.0;
+    for (size_t i = 0; i < m_tasks.size(); i++) {
+        double start = 0.0;
+        for (TaskId dependency : m_tasks[i].dependencies) {
+            start = std::max(start, finish[dependency]);
+        }
+        finish[i] = start + m_tasks[i].seconds;
+        longest = std::max(longest, finish[i]);
+    }
+    return longest;
+}
+
+} // namespace util
+
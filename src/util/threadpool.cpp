@@ -0,0 +1,156 @@
+/**
+ * Author: Glenn Skelton
+ *
+ * Small work stealing thread pool, see threadpool.h.
+ */
+
+
+#include "threadpool.h"
+
+#include <algorithm>
+#include <atomic>
+
+namespace util {
+
+namespace {
+
+// the pool and queue of the worker running on this thread, if any
+thread_local ThreadPool const *t_pool = nullptr;
+thread_local size_t t_queue = 0;
+
+} // namespace
+
+ThreadPool::ThreadPool(size_t threadCount) {
+    // the caller of parallelFor also does work, so one fewer worker is needed,
+    // but tasks that are only submitted still need one worker to run them
+    size_t workerCount = std::max<size_t>(threadCount, 2) - 1;
+    for (size_t i = 0; i <= workerCount; ++i) {
+        m_queues.emplace_back(new WorkQueue());
+    }
+    for (size_t i = 0; i < workerCount; ++i) {
+        m_workers.emplace_back(&ThreadPool::workerLoop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_wake.notify_all();
+    for (std::thread &worker : m_workers) {
+        worker.join();
+    }
+}
+
+size_t ThreadPool::threadCount() const { return m_workers.size() + 1; }
+
+size_t ThreadPool::homeQueue() const { return t_pool == this ? t_queue : m_queues.size() - 1; }
+
+void ThreadPool::submit(std::function<void()> task) {
+    {
+        WorkQueue &queue = *m_queues[homeQueue()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back(std::move(task));
+    }
+    m_queued.fetch_add(1, std::memory_order_release);
+
+    // taking the lock orders this with a worker checking m_queued before it sleeps
+    { std::lock_guard<std::mutex> lock(m_mutex); }
+    m_wake.notify_one();
+}
+
+void ThreadPool::parallelFor(size_t count, std::function<void(size_t, size_t)> const &fn, size_t minChunk) {
+    if (count == 0) {
+        return;
+    }
+
+    size_t chunks = std::min(threadCount(), (count + minChunk - 1) / std::max<size_t>(minChunk, 1));
+    if (chunks <= 1) {
+        fn(0, count);
+        return;
+    }
+
+    size_t chunkSize = (count + chunks - 1) / chunks;
+    std::atomic<size_t> remaining(chunks);
+
+    for (size_t c = 1; c < chunks; ++c) {
+        size_t begin = c * chunkSize;
+        size_t end = std::min(count, begin + chunkSize);
+        submit([&fn, &remaining, begin, end]() {
+            if (begin < end) {
+                fn(begin, end);
+            }
+            remaining.fetch_sub(1, std::memory_order_release);
+        });
+    }
+
+    fn(0, std::min(count, chunkSize));
+    remaining.fetch_sub(1, std::memory_order_release);
+
+    // help with queued work rather than sleeping while the chunks finish
+    while (remaining.load(std::memory_order_acquire) > 0) {
+        if (!runPendingTask()) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+bool ThreadPool::takeTask(size_t queue, bool newest, std::function<void()> &task) {
+    WorkQueue &q = *m_queues[queue];
+    std::lock_guard<std::mutex> lock(q.mutex);
+    if (q.tasks.empty()) {
+        return false;
+    }
+    if (newest) {
+        task = std::move(q.tasks.back());
+        q.tasks.pop_back();
+    } else {
+        task = std::move(q.tasks.front());
+        q.tasks.pop_front();
+    }
+    m_queued.fetch_sub(1, std::memory_order_relaxed);
+    return true;
+}
+
+bool ThreadPool::runPendingTask() {
+    if (m_queued.load(std::memory_order_acquire) == 0) {
+        return false;
+    }
+
+    // own work newest first, then steal the oldest task of the other queues
+    size_t home = homeQueue();
+    size_t count = m_queues.size();
+    std::function<void()> task;
+    bool found = takeTask(home, true, task);
+    for (size_t i = 1; !found && i < count; ++i) {
+        found = takeTask((home + i) % count, false, task);
+    }
+    if (!found) {
+        return false;
+    }
+    task();
+    return true;
+}
+
+void ThreadPool::workerLoop(size_t queue) {
+    t_pool = this;
+    t_queue = queue;
+    for (;;) {
+        if (runPendingTask()) {
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_wake.wait(lock, [this]() { return m_stopping || m_queued.load(std::memory_order_acquire) > 0; });
+        if (m_stopping && m_queued.load(std::memory_order_acquire) == 0) {
+            return;
+        }
+    }
+}
+
+ThreadPool &defaultThreadPool() {
+    static ThreadPool pool;
+    return pool;
+}
+
+} // namespace util